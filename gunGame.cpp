@@ -17,10 +17,29 @@ for updates, see: https://github.com/danryder/bzGunGameStyle
 */
 
 #include "bzfsAPI.h"
+#include "gunGameShm.h"
+#include "gunGameLadder.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <strings.h>
 #include <map>
+#include <set>
 #include <utility>
 #include <functional>
 #include <string>
@@ -30,12 +49,93 @@ using namespace std;
 
 #define DELAYSEC 0.25
 #define RETRYSEC 0.1
+#define ROSTERSEC 1.0
 #define MINORWARN 3
 #define MAJORWARN 1
 #define DETECTCHEAT 1
-#define CHEATPENALTY 3
-#define SUICIDEPENALTY 1
 #define REQUIRECRUSH 3
+#define MAXARENAS 8
+#define MAXPLAYERS 256
+
+// tick scheduler - budget in microseconds, task priorities (low runs first)
+#define TICKBUDGET 2000
+#define TASK_ADVANCES 0
+#define TASK_GIVES 1
+#define TASK_REPLICA 5
+#define TASK_ROSTER 10
+#define TASK_PUBLISH 20
+#define TASK_TRACE 30
+#define TASK_HINTS 25
+#define TASK_SPILL 35
+#define TASK_SETTINGS 40
+
+// trace levels (1 warn, 2 info, 3 detail) above GGTRACE_LEVEL are compiled
+// out - build with -DGGTRACE_LEVEL=0 for no tracing at all
+#ifndef GGTRACE_LEVEL
+#define GGTRACE_LEVEL 3
+#endif
+#define TRACERING 1024
+
+// drop-shoot watch - events kept per player, window after a drop in which
+// a shot is suspicious, confidence at which a player is reported,
+// suspicion decay time constant, allowed spread in a drop rhythm
+#define EVENTRING 8
+#define DROPSHOTWINDOW 0.25
+#define SUSPECTLEVEL 0.75
+#define SUSPICIONDECAY 60.0
+#define DEATHDROPSLOP 0.1
+#define RHYTHMJITTER 0.25
+
+// shot rate check - ladder size, server default reload, and how many
+// shots / how much extra rate to allow before calling it cheating
+#define MAXFLAGS 32
+#define RELOADTIME 3.5
+#define MAXSHOTS 5
+#define SHOTSLACK 0.25
+
+// kills by one player in a single tick are applied as one advance
+// multi-kill counts are kept up to this many (and more)
+#define MULTIKILLMAX 4
+
+// flag give latency - histogram buckets (see latencyBounds), arena sizes
+// kept apart (the last one is that many players and up), and how long
+// a player may wait for a flag before it is traced
+#define LATENCYBUCKETS 9
+#define PLAYERBANDS 17
+#define SLOWGIVE 1.0
+
+// shared winners file - callsigns it can hold
+// winners kept in memory before cold ones are spilled, cold winners the
+// spill keeps, its smallest table, slots a tick's rebuild slice copies,
+// rb-tree/list node overhead (for memory reports)
+#define WINNERSLOTS 4096
+#define MAXWINNERS 1000
+#define MAXSPILL 50000
+#define SPILLMINSLOTS 64
+#define SPILLSLICE 256
+#define NODEBYTES 32
+
+// warm standby replication - batch marker and format version, batches
+// queued for a slow standby before it gets a fresh snapshot instead,
+// seconds a standby that took over keeps levels for players to reclaim,
+// most winners a snapshot carries (it bounds the batch size too)
+#define REPLMAGIC 0x50524747
+#define REPLVERSION 1
+#define REPLQUEUE 256
+#define REPLRESUMESEC 300.0
+#define REPLMAXWINNERS 10000
+
+// chat output - winners per /winners page, flags per /flags line,
+// seconds a player must wait between flags/winners/leaders commands
+#define WINNERSPAGE 10
+#define FLAGSPERLINE 10
+#define COMMANDCOOLDOWN 2.0
+
+// SR endgame - player grid cell size, default world size,
+// seconds between "nearest target" hints
+#define GRIDCELL 50.0f
+#define WORLDSIZE 800.0f
+#define HINTSEC 10.0
 
 // hide SR bullets completely from others or make them PZ
 // ineffective either way, but PZ can fool others
@@ -48,385 +148,1666 @@ using namespace std;
 // enable this if playing sounds from a plugin crashing clients is fixed
 // #define PLAYSOUNDS
 
-// ORDERED LIST OF ALL THE FLAGS WE MIGHT USE
-// along with the #players required to enable them
-typedef struct {
-    const char *flagName;
-    size_t playersRequired;
-} FlagOption;
-
-FlagOption possibleFlags[] = {
-        {"L", 2},
-        {"GM", 2},
-        {"SW", 3},
-        {"CL", 3},
-        {"F", 2},
-        {"IB", 3},
-        {"A", 2},
-        {"MG", 2},
-        {"ST", 2},
-        {"T", 2},
-        {"SB", 2},
-        {"V", 2},
-        {"BU", 3},
-        {"WG", 3},
-        {"QT", 2},
-        {"M", 4},
-        {"B", 4},
-        {"O", 4},
-        {"RT", 5},
-        {"LT", 5},
-        {"WA", 3},
-        {"JM", 4},
-        {"NJ", 4},
-        {"RC", 3},
-        {"SR", 2},
-        {NULL, 0}
+// unix time - for anything read outside the server process
+static double wallClock()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// resident set of the whole server in KB, 0 if unknown (not Linux)
+static long residentKB()
+{
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// debug tracing
+// the event path only copies a small binary record into a ring, and only
+// if its category is on.  the tick scheduler formats the records later
+// and sends them to the debugger and/or appends them to _ggTraceFile
+enum TraceCategory
+{
+    TRACE_SHOTS  = 1 << 0,
+    TRACE_FLAGS  = 1 << 1,
+    TRACE_LADDER = 1 << 2,
+    TRACE_CHEAT  = 1 << 3,
+    TRACE_ALL    = 0xff
+};
+
+enum TraceEvent
+{
+    TE_KILLNOFLAG,    // killer had no flag, not SR or BU
+    TE_ADVANCE,       // a: new flag#, b: its level
+    TE_SHOTNOFLAG,
+    TE_SHOTTYPE,      // s1: shot type, s2: flag it should have been
+    TE_SHOTRATE,      // s1: flag
+    TE_WORLDSHOT,
+    TE_DROPALIVE,     // s1: flag
+    TE_REGIVE,        // a: success
+    TE_DROPUPGRADE,   // s1: dropped, s2: upgrading to
+    TE_MULTIKILL,     // a: kills, s1: flag
+    TE_SLOWGIVE,      // a: ms unarmed, b: failed tries, s1: flag, s2: cause
+    TE_SUSPECT        // a: confidence %
+};
+
+struct TraceRecord
+{
+    double time;
+    unsigned char level;
+    unsigned char category;
+    unsigned short event;
+    int playerID;
+    int a, b;
+    char s1[8], s2[8];
+    char who[GGSHM_CALLSIGNLEN];     // copied now - the slot may be someone else by drain time
 };
 
-class FlagManager
+class Tracer
 {
 private:
+    TraceRecord ring[TRACERING];
+    unsigned int head, tail;     // records written / drained
+    unsigned long overwritten;
+    FILE *file;
+    string fileName;
 
-    struct ltstr
+    static void copyTag(char *to, const char *from)
     {
-      bool operator()(const char* s1, const char* s2) const
-      {
-        return strcmp(s1, s2) < 0;
-      }
-    };
+        strncpy(to, from ? from : "", 7);
+        to[7] = 0;
+    }
 
-    typedef map<int, int> AssignedFlagsType;
-    typedef map<size_t, int> FlagLevelsType;
-    typedef map<const char *, int, ltstr> WinnersListType;
-    struct DelayedFlagType{
-        DelayedFlagType(double t=0.0, const char *f=NULL)
-               : givetime(t), flag(f) {}
-        double givetime;
-        const char *flag;
-    };
+    static const char *categoryName(int category)
+    {
+        switch (category)
+        {
+            case TRACE_SHOTS: return "shots";
+            case TRACE_FLAGS: return "flags";
+            case TRACE_LADDER: return "ladder";
+            case TRACE_CHEAT: return "cheat";
+        }
+        return "?";
+    }
 
-    AssignedFlagsType assignedFlags; // flag# assigned by player ID
-    FlagLevelsType flagLevels;       // flag levels of all enabled flags (by flag#)
-    WinnersListType winnersList;     // total wins by player ID
+    static void format(const TraceRecord &r, char *buf, size_t len)
+    {
+        const char *who = r.who[0] ? r.who : "?";
+        switch (r.event)
+        {
+            case TE_KILLNOFLAG:
+                snprintf(buf, len, "Possible cheating? %s killed without flag, not SR or BU.", who);
+                break;
+            case TE_ADVANCE:
+                snprintf(buf, len, "-> ATTENTION: %s made a legit kill. new flag is %d which is level %d", who, r.a, r.b);
+                break;
+            case TE_SHOTNOFLAG:
+                snprintf(buf, len, ">>>>>>> %s fired a shot... but has no flag - made it PZ <<<<<", who);
+                break;
+            case TE_SHOTTYPE:
+                snprintf(buf, len, ">>>>>>> %s shot type: %s should have been: %s - made it PZ <<<<<<", who, r.s1, r.s2);
+                break;
+            case TE_SHOTRATE:
+                snprintf(buf, len, ">>>>>>> %s fired %s faster than it reloads - shot dropped <<<<<<", who, r.s1);
+                break;
+            case TE_WORLDSHOT:
+                snprintf(buf, len, ">>>>>>> No Player ID for shot - world weapon?");
+                break;
+            case TE_DROPALIVE:
+                snprintf(buf, len, "%s dropped %s while alive", who, r.s1);
+                break;
+            case TE_REGIVE:
+                snprintf(buf, len, "Immediate re-gift success? %s", r.a ? "yes" : "no");
+                break;
+            case TE_DROPUPGRADE:
+                snprintf(buf, len, "%s dropped: %s to upgrade to: %s", who, r.s1, r.s2);
+                break;
+            case TE_MULTIKILL:
+                snprintf(buf, len, "%s killed %d at once with %s", who, r.a, r.s1);
+                break;
+            case TE_SLOWGIVE:
+                snprintf(buf, len, "%s waited %dms for %s after %s (%d failed tries)", who, r.a, r.s1, r.s2, r.b);
+                break;
+            case TE_SUSPECT:
+                snprintf(buf, len, "Drop-shoot suspect: %s (%d%% confidence) - see /ggsuspects", who, r.a);
+                break;
+            default:
+                snprintf(buf, len, "trace event %d", r.event);
+        }
+    }
+
+public:
+    unsigned int mask;           // enabled categories - all the event path reads
+    bool toChat;
+    int chatDest;
 
-    size_t numTotalFlags;        // #flags that could be enabled
-    size_t numEnabledFlags;      // #flags actually enabled
-    size_t minPlayers;           // min players for a game
-    int firstFlag;               // first flag enabled
-    int lastFlag;                // last flag enabled
+    Tracer() : head(0), tail(0), overwritten(0), file(NULL), mask(0), toChat(true), chatDest(BZ_ALLUSERS) {}
+    ~Tracer() { close(); }
 
-    // if #flags enabled changes (as players come and go), update info about
-    // enabled flags
-    void recalcFlags()
+    // oldest records are overwritten if the drain falls behind
+    void record(int level, int category, int event, int playerID, int a, int b, const char *s1, const char *s2)
     {
-        firstFlag = -1;
-        lastFlag = -1;
-        flagLevels.clear();
-        numEnabledFlags = 0;
-        for (size_t f = 0; f < numTotalFlags; ++f)
+        if (head - tail >= TRACERING)
         {
-            if (possibleFlags[f].playersRequired <= numPlayers)
-            {
-                if (firstFlag < 0) firstFlag = f;
-                lastFlag = f;
-                numEnabledFlags++;
-                flagLevels[f] = numEnabledFlags;
-            }
+            tail++;
+            overwritten++;
         }
+        TraceRecord &r = ring[head % TRACERING];
+        r.time = bz_getCurrentTime();
+        r.level = level;
+        r.category = category;
+        r.event = event;
+        r.playerID = playerID;
+        r.a = a;
+        r.b = b;
+        copyTag(r.s1, s1);
+        copyTag(r.s2, s2);
+        const char *callsign = (playerID >= 0) ? bz_getPlayerCallsign(playerID) : NULL;
+        strncpy(r.who, callsign ? callsign : "", sizeof(r.who) - 1);
+        r.who[sizeof(r.who) - 1] = 0;
+        head++;
     }
 
-    // if #flags enabled changes (as players come and go), update player scores
-    // handle case where a player has a flag now removed from circulation
-    void recalcScores()
+    // whenever a setting changes
+    void configure()
     {
-        for (AssignedFlagsType::iterator i = assignedFlags.begin(); i != assignedFlags.end(); ++i)
+        mask = 0;
+        if (bz_getBZDBBool("_ggDebug")) mask = TRACE_ALL;
+        bz_ApiString cats = bz_getBZDBString("_ggTrace");
+        if (cats.size())
         {
-            int playerID = i->first;
-            int flag = i->second;
-            FlagLevelsType::iterator j = flagLevels.find(flag);
-            if (j != flagLevels.end())
-            {
-                // current flag was still in the list
-                // just update the score with the new position
-                bz_setPlayerWins(playerID, j->second);
-            }
-            else
+            const char *c = cats.c_str();
+            if (strstr(c, "all")) mask |= TRACE_ALL;
+            if (strstr(c, "shots")) mask |= TRACE_SHOTS;
+            if (strstr(c, "flags")) mask |= TRACE_FLAGS;
+            if (strstr(c, "ladder")) mask |= TRACE_LADDER;
+            if (strstr(c, "cheat")) mask |= TRACE_CHEAT;
+        }
+        toChat = bz_getBZDBBool("_ggTraceChat");
+
+        bz_ApiString traceFile = bz_getBZDBString("_ggTraceFile");
+        if (fileName != traceFile.c_str())
+        {
+            close();
+            fileName = traceFile.c_str();
+            if (fileName.size())
             {
-                // player had a flag not in new list
-                // replace it with preceeding valid flag
-                int decr = 0;
-                int newFlagNo = getPrevFlag(flag, decr, 1);
-                j = flagLevels.find(newFlagNo);
-                if (j != flagLevels.end())
-                {
-                    i->second = newFlagNo; // update what flag the player *should* have
-                    bz_setPlayerWins(playerID, j->second);
-                    const char *newFlag = possibleFlags[newFlagNo].flagName;
-                    replaceFlagIfAlive(playerID, newFlag, "flag deactivated");
-                }
-                else
-                {
-                    // this should never happen
-                    bz_sendTextMessagef(BZ_SERVER, debuggerID, "ERROR: PREVIOUS FLAG NOT DEFINED");
-                }
+                file = fopen(fileName.c_str(), "a");
+                if (!file) bz_debugMessagef(1, "GunGame: can't open trace file %s", fileName.c_str());
             }
         }
     }
 
-    // flag progression
-    int getNextFlag(int oldFlag, int &delta, int count=1)
+    void close()
+    {
+        if (file) fclose(file);
+        file = NULL;
+        fileName.clear();
+    }
+
+    size_t backlog() { return head - tail; }
+
+    // format and send one record, true while more are waiting
+    bool drainOne()
     {
-        int c = 0;
-        delta = 0;
-        if (oldFlag >= lastFlag) return lastFlag;
-        for (int f = oldFlag+1; f < numTotalFlags; ++f)
+        if (head == tail) return false;
+        const TraceRecord &r = ring[tail % TRACERING];
+        char line[256];
+        format(r, line, sizeof(line));
+        if (toChat)
+        {
+            bz_sendTextMessagef(BZ_SERVER, chatDest, "%s", line);
+        }
+        if (file)
         {
-            if (possibleFlags[f].playersRequired <= numPlayers)
+            if (overwritten)
             {
-                delta += 1;
-                if ((++c==count) || (f == lastFlag))
-                {
-                    return f;
-                }
+                fprintf(file, "%.3f - %lu trace records lost, ring full\n", r.time, overwritten);
+                overwritten = 0;
             }
+            fprintf(file, "%.3f %d %s %s\n", r.time, r.level, categoryName(r.category), line);
         }
-        return -1;
+        tail++;
+        if ((head == tail) && file) fflush(file);
+        return head != tail;
     }
+};
+
+// each class that traces holds a Tracer *tracer - the plugin's own ring
+#define GGTRACE(level, cat, event, playerID, a, b, s1, s2) \
+    do { if (tracer->mask & (cat)) tracer->record(level, cat, event, playerID, a, b, s1, s2); } while (0)
+#if GGTRACE_LEVEL >= 1
+#define TRACE_WARN(cat, event, playerID, a, b, s1, s2) GGTRACE(1, cat, event, playerID, a, b, s1, s2)
+#else
+#define TRACE_WARN(cat, event, playerID, a, b, s1, s2) do {} while (0)
+#endif
+#if GGTRACE_LEVEL >= 2
+#define TRACE_INFO(cat, event, playerID, a, b, s1, s2) GGTRACE(2, cat, event, playerID, a, b, s1, s2)
+#else
+#define TRACE_INFO(cat, event, playerID, a, b, s1, s2) do {} while (0)
+#endif
+#if GGTRACE_LEVEL >= 3
+#define TRACE_DETAIL(cat, event, playerID, a, b, s1, s2) GGTRACE(3, cat, event, playerID, a, b, s1, s2)
+#else
+#define TRACE_DETAIL(cat, event, playerID, a, b, s1, s2) do {} while (0)
+#endif
+
+// what made a player's flag change
+enum GiveCause
+{
+    GIVE_KILL,        // advanced
+    GIVE_SPAWN,
+    GIVE_DEMOTE,      // suicide (given at the next spawn) or cheat
+    GIVE_LADDER,      // game begin, win, flag deactivated
+    GIVE_DROP,        // dropped while alive, given back
+    GIVECAUSES
+};
+
+static const char *giveCauseNames[GIVECAUSES] = { "kill", "spawn", "demote", "ladder", "drop" };
+
+// upper bound of each latency bucket, seconds - the last is open
+static const double latencyBounds[LATENCYBUCKETS - 1] = { 0.01, 0.05, 0.1, 0.25, 0.5, 1.0, 2.0, 5.0 };
+
+// flag give latency as players feel it - from whatever changed their
+// flag (kill, spawn, demotion, ladder change, drop) until a give
+// actually lands, delayed retries included.  a transition that is
+// still open when the player dies or leaves was abandoned
+class GiveLatency
+{
+private:
+    struct Transition
+    {
+        double since;                // when the player should have had the flag
+        int cause;
+        int nextCause;               // cause for the next spawn
+        unsigned int failed;         // failed tries so far
+        bool open;
+    };
 
-    // flag regression
-    int getPrevFlag(int oldFlag, int &delta, int count=1)
+    struct GiveStats
     {
-        int c = 0;
-        delta = 0;
-        if (oldFlag <= firstFlag) return firstFlag;
-        for (int f = oldFlag-1; f >= 0; --f)
+        unsigned long landed;
+        unsigned long failed;
+        unsigned long hist[LATENCYBUCKETS];
+        double unarmed;              // total seconds waited
+        double worst;
+
+        void add(double latency)
+        {
+            int b = 0;
+            while ((b < LATENCYBUCKETS - 1) && (latency >= latencyBounds[b])) ++b;
+            hist[b]++;
+            landed++;
+            unarmed += latency;
+            if (latency > worst) worst = latency;
+        }
+
+        // bucket bound at or under which fraction q of the gives landed
+        const char *percentile(double q, char *buf, size_t len) const
         {
-            if (possibleFlags[f].playersRequired <= numPlayers)
+            if (!landed) return "-";
+            unsigned long want = (unsigned long)ceil(q * landed), seen = 0;
+            for (int b = 0; b < LATENCYBUCKETS - 1; ++b)
             {
-                delta += 1;
-                if ((++c==count) || (f == firstFlag))
+                seen += hist[b];
+                if (seen >= want)
                 {
-                    return f;
+                    snprintf(buf, len, "<%gs", latencyBounds[b]);
+                    return buf;
                 }
             }
+            snprintf(buf, len, "%gs+", latencyBounds[LATENCYBUCKETS - 2]);
+            return buf;
+        }
+
+        void report(int dest, const char *label) const
+        {
+            char p50[16], p90[16];
+            bz_sendTextMessagef(BZ_SERVER, dest, "  %s: %lu landed, p50 %s, p90 %s, worst %.2fs, %lu failed tries",
+                                label, landed, percentile(0.5, p50, sizeof(p50)), percentile(0.9, p90, sizeof(p90)),
+                                worst, failed);
+        }
+    };
+
+    Transition players[MAXPLAYERS];
+    GiveStats byFlag[MAXFLAGS];
+    GiveStats byPlayers[PLAYERBANDS];
+    GiveStats byCause[GIVECAUSES];
+    unsigned long failedAt[MAXFLAGS][PLAYERBANDS];
+    unsigned long abandoned;
+    Tracer *tracer;              // for slow gives
+
+    static int flagNumber(const char *flagName)
+    {
+        for (int f = 0; (f < MAXFLAGS) && possibleFlags[f].flagName; ++f)
+        {
+            if (0 == strcmp(possibleFlags[f].flagName, flagName)) return f;
         }
         return -1;
     }
 
-    // sometimes we don't care how many we've traversed
-    int getNextFlag(int oldFlag, int count=1) {
-        int foo = 0;
-        return getNextFlag(oldFlag, foo, count);
-    }
-    int getPrevFlag(int oldFlag, int count=1) {
-        int foo = 0;
-        return getPrevFlag(oldFlag, foo, count);
+    static int band(int numPlayers)
+    {
+        if (numPlayers < 0) return 0;
+        return (numPlayers < PLAYERBANDS) ? numPlayers : PLAYERBANDS - 1;
     }
 
-    int numPlayersNeeded()
+public:
+    GiveLatency() : tracer(NULL)
     {
-        return (minPlayers - numPlayers);
+        reset();
     }
 
-    bool gameOn()
+    void attach(Tracer *t) { tracer = t; }
+
+    void reset()
     {
-        return (numPlayersNeeded() <= 0);
+        memset(players, 0, sizeof(players));
+        memset(byFlag, 0, sizeof(byFlag));
+        memset(byPlayers, 0, sizeof(byPlayers));
+        memset(byCause, 0, sizeof(byCause));
+        memset(failedAt, 0, sizeof(failedAt));
+        abandoned = 0;
+        for (int p = 0; p < MAXPLAYERS; ++p) players[p].nextCause = GIVE_SPAWN;
     }
 
-public:
-    // members accessed in plugin class
-    typedef map<int, DelayedFlagType> DelayedFlagsType;
-    DelayedFlagsType delayedFlags;
-    size_t numPlayers;
-    int debuggerID;
+    // the player should now hold a different flag.  if they were already
+    // waiting for one, they have been unarmed since then
+    void begin(int playerID, int cause, double since)
+    {
+        if ((playerID < 0) || (playerID >= MAXPLAYERS)) return;
+        Transition &t = players[playerID];
+        if (t.open && (t.since <= since)) return;
+        if (!t.open) t.failed = 0;
+        t.since = since;
+        t.cause = cause;
+        t.open = true;
+    }
 
-    FlagManager()
-         : minPlayers(0),
-           numPlayers(0),
-           numEnabledFlags(0),
-           debuggerID(BZ_ALLUSERS)
+    // the flag comes with the next spawn - say why
+    void expect(int playerID, int cause)
     {
-        // count all flags, determine min #Players required
-        numTotalFlags = 0;
-        FlagOption *f = &possibleFlags[0];
-        while (f && f->flagName)
-        {
-            numTotalFlags++;
-            if (!minPlayers || (f->playersRequired < minPlayers))
-                minPlayers = f->playersRequired;
-            f++;
-        }
+        if ((playerID < 0) || (playerID >= MAXPLAYERS)) return;
+        players[playerID].nextCause = cause;
     }
 
-    ~FlagManager()
+    // spawned - takes the cause set by expect(), if any
+    void spawned(int playerID, double now)
     {
-        for (WinnersListType::iterator i = winnersList.begin(); i != winnersList.end(); ++i)
-        {
-            char *key = const_cast<char *>(i->first);
-            winnersList.erase(i);
-            free(key);
-        }
+        if ((playerID < 0) || (playerID >= MAXPLAYERS)) return;
+        Transition &t = players[playerID];
+        end(playerID);
+        begin(playerID, t.nextCause, now);
+        t.nextCause = GIVE_SPAWN;
     }
 
-    // return true if this starts a game
-    bool addPlayer(const bz_PlayerJoinPartEventData_V1 *joinData)
+    // died or left before the flag arrived
+    void end(int playerID)
     {
-        bool start = false;
-        const char *newGuy = bz_getPlayerCallsign(joinData->playerID);
-        if (numPlayers)
-        {
-            bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS, 
-                                "Everyone say \"Hi %s!\", player #%d (ID %d)",
-                                newGuy, numPlayers, joinData->playerID);
-        }
-        bz_sendTextMessagef(BZ_SERVER, joinData->playerID, 
-                            "Welcome to \"GunGame Style\", %s...",
-                            newGuy);
+        if ((playerID < 0) || (playerID >= MAXPLAYERS)) return;
+        if (players[playerID].open) abandoned++;
+        players[playerID].open = false;
+    }
 
-        bool wasGameOn = gameOn();
-        int oldNumFlags = numEnabledFlags;
+    void parted(int playerID)
+    {
+        end(playerID);
+        if ((playerID >= 0) && (playerID < MAXPLAYERS)) players[playerID].nextCause = GIVE_SPAWN;
+    }
 
-        numPlayers++;
-        recalcFlags();
+    bool waiting(int playerID) const
+    {
+        return (playerID >= 0) && (playerID < MAXPLAYERS) && players[playerID].open;
+    }
 
-        if (gameOn())
+    // every bz_givePlayerFlag, first try or retry.  retries for a player
+    // who has died since don't count - nobody is waiting on those
+    void gave(int playerID, const char *flagName, bool ok, int numPlayers, double now)
+    {
+        if ((playerID < 0) || (playerID >= MAXPLAYERS) || !flagName) return;
+        Transition &t = players[playerID];
+        if (!t.open) return;
+        int flag = flagNumber(flagName);
+        int b = band(numPlayers);
+        if (!ok)
         {
-            int numFlags = numEnabledFlags;
-            if (!wasGameOn)
-            {
-                beginGG();
-                start = true;
-                bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS, 
-                            "\"GunGame Style\" started with %d players %d flags",
-                            numPlayers, numFlags);
-                listFlags();
-                bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS,
-                            "Commands: \"flags\", \"winners\", \"leaders\"");
-            }
-            else 
+            t.failed++;
+            if (flag >= 0)
             {
-                // game already in progress.  tell new player flag list
-                listFlags(joinData->playerID);
-                if (oldNumFlags < numFlags)
-                {
-                    bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS,
-                                        "\"GunGame Style\" added %d flags to win...",
-                                        numFlags - oldNumFlags);
-                    // adjust scores to map to new flags
-                    recalcScores();
-                }
+                byFlag[flag].failed++;
+                failedAt[flag][b]++;
             }
-            assignedFlags[joinData->playerID] = firstFlag;
-            bz_setPlayerWins(joinData->playerID, 1);
-            bz_setPlayerLosses(joinData->playerID, 0);
-            bz_setPlayerTKs(joinData->playerID, 0);
+            byPlayers[b].failed++;
+            byCause[t.cause].failed++;
+            return;
         }
-        else
+        double latency = now - t.since;
+        if (latency < 0.0) latency = 0.0;
+        if (flag >= 0) byFlag[flag].add(latency);
+        byPlayers[b].add(latency);
+        byCause[t.cause].add(latency);
+        if (latency >= SLOWGIVE)
         {
-            // no game yet
-            assignedFlags[joinData->playerID] = -1;
-            int needed = numPlayersNeeded();
-            bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS, 
-                                "\"GunGame Style\" awaiting %d more player%s...",
-                                needed, (needed > 1) ? "s": "");
+            TRACE_INFO(TRACE_FLAGS, TE_SLOWGIVE, playerID, (int)(latency * 1000), t.failed, flagName, giveCauseNames[t.cause]);
         }
-
-        return start;
+        t.open = false;
     }
 
-    // return true if this suspends a game
-    bool removePlayer(const bz_PlayerJoinPartEventData_V1 *partData)
+    // totals by cause, then the flags and arena sizes with anything to
+    // show.  with a flag, that flag's failed tries by arena size
+    void report(int dest, const char *flagName)
     {
-        bool end = false;
-        bool wasGameOn = gameOn();
-        int oldNumFlags = numEnabledFlags;
-        if (numPlayersNeeded() == 0) announceLeaders(BZ_ALLUSERS);
+        char label[32];
+        if (flagName && *flagName)
+        {
+            int flag = flagNumber(flagName);
+            if (flag < 0)
+            {
+                bz_sendTextMessagef(BZ_SERVER, dest, "no flag %s on the ladder", flagName);
+                return;
+            }
+            byFlag[flag].report(dest, flagName);
+            string line = "failed tries by players in the arena:";
+            for (int b = 0; b < PLAYERBANDS; ++b)
+            {
+                if (!failedAt[flag][b]) continue;
+                snprintf(label, sizeof(label), "  %d%s: %lu", b, (b == PLAYERBANDS - 1) ? "+" : "", failedAt[flag][b]);
+                line += label;
+            }
+            bz_sendTextMessagef(BZ_SERVER, dest, "%s", line.c_str());
+            return;
+        }
 
-        if (numPlayers > 0)
+        GiveStats all;
+        memset(&all, 0, sizeof(all));
+        for (int c = 0; c < GIVECAUSES; ++c)
         {
-            numPlayers--;
+            all.landed += byCause[c].landed;
+            all.unarmed += byCause[c].unarmed;
         }
-        else
+        unsigned long failed = 0;
+        for (int b = 0; b < PLAYERBANDS; ++b) failed += byPlayers[b].failed;
+        bz_sendTextMessagef(BZ_SERVER, dest, "flag gives: %lu landed, %lu failed tries, %lu abandoned, %.0fs unarmed in all",
+                            all.landed, failed, abandoned, all.unarmed);
+        bz_sendTextMessagef(BZ_SERVER, dest, "by cause:");
+        for (int c = 0; c < GIVECAUSES; ++c)
         {
-            // weird case seen - joined empty server and was told I was player #-2
-            // not sure how this could get off track
-            // might need to call bz_getPlayerCount() instead of maintaining
-            bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS,
-                               "\"%s\" is leaving, but numPlayers is already %d.",
-                               bz_getPlayerCallsign(partData->playerID),
-                               numPlayers);
+            if (byCause[c].landed || byCause[c].failed) byCause[c].report(dest, giveCauseNames[c]);
+        }
+        bz_sendTextMessagef(BZ_SERVER, dest, "by flag:");
+        for (int f = 0; (f < MAXFLAGS) && possibleFlags[f].flagName; ++f)
+        {
+            if (byFlag[f].landed || byFlag[f].failed) byFlag[f].report(dest, possibleFlags[f].flagName);
+        }
+        bz_sendTextMessagef(BZ_SERVER, dest, "by players in the arena:");
+        for (int b = 0; b < PLAYERBANDS; ++b)
+        {
+            if (!byPlayers[b].landed && !byPlayers[b].failed) continue;
+            snprintf(label, sizeof(label), "%d%s", b, (b == PLAYERBANDS - 1) ? "+" : "");
+            byPlayers[b].report(dest, label);
         }
-        recalcFlags();
 
-        assignedFlags.erase(partData->playerID);
-        if (!gameOn())
+        // the map is short on whatever fails most
+        string line;
+        unsigned long shown[MAXFLAGS];
+        memset(shown, 0, sizeof(shown));
+        for (int n = 0; n < 5; ++n)
         {
-            if (wasGameOn)
+            int most = -1;
+            for (int f = 0; (f < MAXFLAGS) && possibleFlags[f].flagName; ++f)
             {
-                bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS, 
-                                   "\"GunGame Style\" suspended - thanks a lot \"%s\"!",
-                                   bz_getPlayerCallsign(partData->playerID));
-                endGG();
-                end = true;
-                bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS, 
-                                   "\"GunGame Style\" needs one more player to restart...");
-            }
-            else
-            {
-                bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS,
-                                    "\"GunGame Style\" now needs %d more players to restart...",
-                                    numPlayersNeeded());
+                if (!shown[f] && byFlag[f].failed && ((most < 0) || (byFlag[f].failed > byFlag[most].failed))) most = f;
             }
+            if (most < 0) break;
+            shown[most] = 1;
+            snprintf(label, sizeof(label), " %s(%lu)", possibleFlags[most].flagName, byFlag[most].failed);
+            line += label;
         }
-        else
+        if (line.size()) bz_sendTextMessagef(BZ_SERVER, dest, "most failed:%s - see /gggives <flag>", line.c_str());
+    }
+};
+
+// wins by callsign in a mmap'd file - a fixed size open addressing table
+// keyed by callsign hash.  only atomic ops touch it - no locks
+// shared: every server on this host that uses the same _ggWinnersFile
+// adds its own wins.  private: the scoreboard's spill for cold winners
+class WinnersTable
+{
+private:
+    enum { MAGIC = 0x57474747, VERSION = 1, EMPTY = 0, CLAIMED = 1 };
+
+    struct Slot
+    {
+        volatile uint32_t key;       // EMPTY, CLAIMED (callsign being written) or hash
+        volatile int32_t wins;
+        char callsign[GGSHM_CALLSIGNLEN];
+    };
+
+    struct Table
+    {
+        volatile uint32_t magic;
+        uint32_t version;
+        uint32_t numSlots;
+        volatile uint32_t used;
+        Slot slots[1];               // numSlots of them
+    };
+
+    Table *table;
+    uint32_t numSlots;
+    string path;
+    set<uint32_t> stuckSlots;        // CLAIMED and never settled - a server died mid-claim
+
+    static size_t fileSize(uint32_t slots)
+    {
+        return sizeof(Table) + (slots - 1) * sizeof(Slot);
+    }
+
+    // the callsign's slot, or an empty one to claim (NULL if full)
+    Slot *find(const char *callsign, uint32_t key)
+    {
+        for (uint32_t n = 0; n < numSlots; ++n)
         {
-            // game continues
-            int numFlags = numEnabledFlags;
-            if (oldNumFlags > numFlags)
+            uint32_t index = (key + n) % numSlots;
+            Slot &slot = table->slots[index];
+            if (slot.key == EMPTY) return &slot;
+            if ((settledKey(index) == key) &&
+                (strncmp(slot.callsign, callsign, sizeof(slot.callsign) - 1) == 0))
             {
-                bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS,
-                                    "\"GunGame Style\" removed %d flags to win...",
-                                    oldNumFlags - numFlags);
-                // adjust scores to map to new flags
-                recalcScores();
+                return &slot;
             }
         }
-        return end;
+        return NULL;
     }
 
-    void givePlayerFlagDelayed(int playerID, const char *flagName)
+    // FNV-1a, kept clear of EMPTY and CLAIMED
+    static uint32_t hash(const char *callsign)
     {
-        double now = bz_getCurrentTime();
-        delayedFlags[playerID].flag = flagName;
-        delayedFlags[playerID].givetime = now + DELAYSEC;
+        uint32_t h = 2166136261u;
+        for (; *callsign; ++callsign)
+        {
+            h ^= (unsigned char)*callsign;
+            h *= 16777619u;
+        }
+        return (h <= CLAIMED) ? h + 2 : h;
     }
 
-    bool givePlayerFlagNow(int playerID, const char *flagName)
+    // a slot being claimed by another server is only CLAIMED for a moment
+    // one that doesn't settle was left by a crash - spin on it once, then
+    // skip it like any other callsign's slot
+    uint32_t settledKey(uint32_t index)
     {
-        return bz_givePlayerFlag(playerID, flagName, true);
+        Slot &slot = table->slots[index];
+        uint32_t k = slot.key;
+        if (k != CLAIMED)
+        {
+            if (!stuckSlots.empty()) stuckSlots.erase(index);
+            return k;
+        }
+        if (stuckSlots.count(index)) return k;
+        for (int spin = 0; (k == CLAIMED) && (spin < 10000); ++spin)
+        {
+            k = slot.key;
+        }
+        if (k == CLAIMED)
+        {
+            stuckSlots.insert(index);
+            bz_debugMessagef(1, "GunGame: winners file %s slot %u stuck mid-claim - skipping it", path.c_str(), index);
+        }
+        return k;
     }
 
-    // returns True if flag give succeeded immediately
-    // otherwise queues it up and returns False
-    bool givePlayerFlag(int playerID, const char *flagName)
+public:
+    WinnersTable() : table(NULL), numSlots(0) {}
+    ~WinnersTable() { close(); }
+
+    bool isOpen() { return table != NULL; }
+    const string &getPath() { return path; }
+
+    // on failure the path is still remembered, so we don't retry every tick
+    // "fresh" empties the file first - only for files no one else uses
+    bool open(const char *fileName, uint32_t slots = WINNERSLOTS, bool fresh = false)
     {
-        bool now = givePlayerFlagNow(playerID, flagName);
-        if (now) return true;
-        givePlayerFlagDelayed(playerID, flagName);
-        return false;
+        close();
+        if (!fileName || !*fileName) return false;
+        path = fileName;
+        numSlots = slots;
+
+        int fd = ::open(fileName, O_CREAT | O_RDWR | (fresh ? O_TRUNC : 0), 0644);
+        if (fd < 0)
+        {
+            bz_debugMessagef(1, "GunGame: can't open winners file %s", fileName);
+            return false;
+        }
+        // growing it is safe even if another server just did the same
+        struct stat st;
+        void *mem = MAP_FAILED;
+        if ((fstat(fd, &st) == 0) &&
+            ((st.st_size >= (off_t)fileSize(numSlots)) || (ftruncate(fd, fileSize(numSlots)) == 0)))
+        {
+            mem = mmap(NULL, fileSize(numSlots), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (mem == MAP_FAILED)
+        {
+            bz_debugMessagef(1, "GunGame: can't map winners file %s", fileName);
+            return false;
+        }
+        table = (Table *)mem;
+
+        // first server in stamps the header, the rest check it
+        if (__sync_bool_compare_and_swap(&table->magic, 0, CLAIMED))
+        {
+            table->version = VERSION;
+            table->numSlots = numSlots;
+            __sync_synchronize();
+            table->magic = MAGIC;
+        }
+        for (int spin = 0; (table->magic == CLAIMED) && (spin < 10000); ++spin);
+        if ((table->magic != MAGIC) || (table->version != VERSION) || (table->numSlots != numSlots))
+        {
+            bz_debugMessagef(1, "GunGame: %s is not a winners file", fileName);
+            munmap(table, fileSize(numSlots));
+            table = NULL;
+            return false;
+        }
+        return true;
     }
 
-    void replaceFlagIfAlive(int playerID, const char *flagName, const char *reason, bool tryFast=false)
+    // the file stays - it outlives any one server
+    void close()
     {
-         bz_BasePlayerRecord *pr = bz_getPlayerByIndex(playerID);
-         if (pr)
-         {
+        if (table)
+        {
+            munmap(table, fileSize(numSlots));
+            table = NULL;
+        }
+        path.clear();
+        stuckSlots.clear();
+    }
+
+    // false if not open or the table is full
+    bool addWins(const char *callsign, int wins)
+    {
+        if (!table || !callsign || !*callsign) return false;
+        uint32_t key = hash(callsign);
+        for (int tries = 0; tries < 2; ++tries)
+        {
+            Slot *slot = find(callsign, key);
+            if (!slot) break;
+            if (slot->key != EMPTY)
+            {
+                __sync_fetch_and_add(&slot->wins, wins);
+                return true;
+            }
+            if (__sync_bool_compare_and_swap(&slot->key, EMPTY, CLAIMED))
+            {
+                strncpy(slot->callsign, callsign, sizeof(slot->callsign) - 1);
+                slot->callsign[sizeof(slot->callsign) - 1] = 0;
+                slot->wins = wins;
+                __sync_synchronize();
+                slot->key = key;
+                __sync_fetch_and_add(&table->used, 1);
+                return true;
+            }
+            // another server claimed it first - look again
+        }
+        bz_debugMessagef(1, "GunGame: winners file %s is full", path.c_str());
+        return false;
+    }
+
+    bool addWin(const char *callsign)
+    {
+        return addWins(callsign, 1);
+    }
+
+    int winsFor(const char *callsign)
+    {
+        if (!table || !callsign || !*callsign) return 0;
+        Slot *slot = find(callsign, hash(callsign));
+        return (slot && (slot->key > CLAIMED)) ? (int)slot->wins : 0;
+    }
+
+    // remove and return a callsign's wins.  the slot keeps the callsign
+    // (open addressing can't free it) and is reused if it comes back
+    int takeWins(const char *callsign)
+    {
+        if (!table || !callsign || !*callsign) return 0;
+        Slot *slot = find(callsign, hash(callsign));
+        return (slot && (slot->key > CLAIMED)) ? __sync_fetch_and_and(&slot->wins, 0) : 0;
+    }
+
+    // walking the table a slot at a time: take the wins out of slot
+    // "index" and copy its callsign.  0 if it holds none
+    int takeSlot(uint32_t index, char *callsign, size_t len)
+    {
+        if (!table || (index >= numSlots)) return 0;
+        Slot &slot = table->slots[index];
+        if (slot.key <= CLAIMED) return 0;
+        __sync_synchronize();
+        int wins = __sync_fetch_and_and(&slot.wins, 0);
+        if (wins <= 0) return 0;
+        size_t n = min(len, sizeof(slot.callsign)) - 1;
+        memcpy(callsign, slot.callsign, n);
+        callsign[n] = 0;
+        return wins;
+    }
+
+    // the file moves, the mapping stays
+    bool rename(const char *newPath)
+    {
+        if (!table || (::rename(path.c_str(), newPath) != 0)) return false;
+        path = newPath;
+        return true;
+    }
+
+    void swap(WinnersTable &other)
+    {
+        std::swap(table, other.table);
+        std::swap(numSlots, other.numSlots);
+        path.swap(other.path);
+        stuckSlots.swap(other.stuckSlots);
+    }
+
+    size_t bytes() { return table ? fileSize(numSlots) : 0; }
+    size_t stuck() { return stuckSlots.size(); }
+    size_t slotsUsed() { return table ? table->used : 0; }
+    size_t slots() { return table ? numSlots : 0; }
+
+    // most wins first, the best "limit" of them (0 - all)
+    typedef multimap<int, string, greater<int> > RankingType;
+    void ranking(RankingType &out, size_t limit = 0)
+    {
+        out.clear();
+        if (!table) return;
+        for (uint32_t n = 0; n < numSlots; ++n)
+        {
+            Slot &slot = table->slots[n];
+            if (slot.key <= CLAIMED) continue;
+            __sync_synchronize();
+            int wins = slot.wins;
+            if (wins <= 0) continue;
+            if (limit && (out.size() >= limit))
+            {
+                RankingType::iterator last = --out.end();
+                if (wins <= last->first) continue;
+                out.erase(last);
+            }
+            char callsign[sizeof(slot.callsign)];
+            memcpy(callsign, slot.callsign, sizeof(callsign));
+            callsign[sizeof(callsign) - 1] = 0;
+            out.insert(pair<int, string>(wins, callsign));
+        }
+    }
+};
+
+// server-wide win history - shared by every arena
+// with _ggMaxWinners set, only that many callsigns stay in memory - the
+// least recently seen go to a spill file (_ggWinnersSpill) and are loaded
+// back when they join or win again.  the spill holds _ggMaxSpill of them;
+// past that the fewest wins are dropped when it is rebuilt
+class Scoreboard
+{
+private:
+    struct ltstr
+    {
+      bool operator()(const char* s1, const char* s2) const
+      {
+        return strcmp(s1, s2) < 0;
+      }
+    };
+
+    typedef list<const char *> RecencyType;
+    struct Winner
+    {
+        int wins;
+        RecencyType::iterator recent;    // place in recency
+    };
+
+    // the best cold winners by wins, fewest first
+    typedef set<pair<int, string> > ColdBestType;
+
+public:
+    typedef map<const char *, Winner, ltstr> WinnersListType;
+    WinnersListType winnersList;     // total wins by callsign (warm ones)
+    WinnersTable global;             // and on every server sharing _ggWinnersFile
+    WinnersTable spill;              // cold ones, private to this server
+
+    Scoreboard()
+         : maxWinners(0),
+           maxSpill(MAXSPILL),
+           numEvicted(0),
+           numLoaded(0),
+           numDropped(0),
+           numCompacted(0),
+           spillCount(0),
+           bestFor(0),
+           rebuildPos(0),
+           cutoff(0),
+           atCutoff(0),
+           rebuildFailed(false),
+           rankingDirty(false)
+    {
+    }
+
+    ~Scoreboard()
+    {
+        for (WinnersListType::iterator i = winnersList.begin(); i != winnersList.end(); ++i)
+        {
+            free(const_cast<char *>(i->first));
+        }
+        winnersList.clear();
+    }
+
+    // from BZDB, whenever a setting changes.  only cheap work here - a
+    // spill that has to move, grow or shrink is rebuilt by compactSlice()
+    void configure(int cap, int spillCap, const char *spillFile)
+    {
+        maxWinners = (cap > 0) ? cap : 0;
+        maxSpill = (spillCap > 0) ? spillCap : 0;
+        spillPath = spillFile;
+        rebuildFailed = false;
+        if (!maxSpill)
+        {
+            numDropped += spillCount;
+            dropSpill();
+        }
+        else if (maxWinners && !spill.isOpen() && !spillPath.empty())
+        {
+            spill.open(spillPath.c_str(), slotsFor(maxSpill), true);
+            bestFor = bestLimit();
+        }
+        trimBest(coldBest);
+        trimBest(nextBest);
+        rankingDirty = true;
+        while (maxWinners && (winnersList.size() > maxWinners)) evict();
+    }
+
+    // the spill dies with the plugin, like the winners kept in memory
+    void dropSpill()
+    {
+        if (spill.isOpen()) unlink(spill.getPath().c_str());
+        if (nextSpill.isOpen()) unlink(nextSpill.getPath().c_str());
+        spill.close();
+        nextSpill.close();
+        spillHist.clear();
+        spillCount = 0;
+        coldBest.clear();
+        nextBest.clear();
+        rankingDirty = true;
+    }
+
+    // a player is around again - keep their wins warm
+    void touch(const char *callsign)
+    {
+        warm(callsign, false);
+    }
+
+    int winsFor(const char *callsign)
+    {
+        WinnersListType::const_iterator i = callsign ? winnersList.find(callsign) : winnersList.end();
+        if (i != winnersList.end()) return i->second.wins;
+        return spill.winsFor(callsign) + nextSpill.winsFor(callsign);
+    }
+
+    // most wins first, only re-sorted after a change
+    // capped, it holds the best _ggMaxWinners of warm and cold together
+    // the cold ones come from coldBest, never from the spill itself
+    typedef multimap<int, const char *, greater<int> > LeaderboardType;
+    const LeaderboardType &ranking()
+    {
+        if (rankingDirty)
+        {
+            leaderboard.clear();
+            for (WinnersListType::const_iterator i = winnersList.begin(); i != winnersList.end(); ++i)
+            {
+                leaderboard.insert(pair<int, const char *>(i->second.wins, i->first));
+            }
+            for (ColdBestType::const_iterator c = coldBest.begin(); c != coldBest.end(); ++c)
+            {
+                leaderboard.insert(pair<int, const char *>(c->first, c->second.c_str()));
+            }
+            while (maxWinners && (leaderboard.size() > maxWinners))
+            {
+                leaderboard.erase(--leaderboard.end());
+            }
+            rankingDirty = false;
+        }
+        return leaderboard;
+    }
+
+    void publish(GGShmState &state)
+    {
+        const LeaderboardType &leaderboard = ranking();
+        state.numWinners = 0;
+        for (LeaderboardType::const_iterator j = leaderboard.begin();
+             (j != leaderboard.end()) && (state.numWinners < GGSHM_MAXWINNERS); ++j)
+        {
+            GGShmWinner &w = state.winners[state.numWinners++];
+            strncpy(w.callsign, j->second, GGSHM_CALLSIGNLEN - 1);
+            w.callsign[GGSHM_CALLSIGNLEN - 1] = 0;
+            w.wins = j->first;
+        }
+    }
+
+    // wins a primary server had for a callsign, when this one took over
+    // from it - the shared file has them already if both used it
+    void restore(const char *callsign, int wins)
+    {
+        WinnersListType::iterator i = warm(callsign, true);
+        if ((i == winnersList.end()) || (i->second.wins >= wins)) return;
+        i->second.wins = wins;
+        rankingDirty = true;
+    }
+
+    void addWinner(const char *callsign)
+    {
+        global.addWin(callsign);
+        WinnersListType::iterator i = warm(callsign, true);
+        if (i == winnersList.end()) return;
+        i->second.wins += 1;
+        rankingDirty = true;
+    }
+
+    // the spill rebuild, a slice at a time from the tick.  starts one when
+    // the spill is full, has moved or been resized, is 3/4 dead slots, or
+    // coldBest has to be refilled.  true while there is more to do
+    bool compactSlice()
+    {
+        if (!nextSpill.isOpen())
+        {
+            if (!compactDue()) return false;
+            return startRebuild();
+        }
+        char callsign[GGSHM_CALLSIGNLEN];
+        for (int n = 0; (n < SPILLSLICE) && (rebuildPos < spill.slots()); ++n, ++rebuildPos)
+        {
+            int wins = spill.takeSlot(rebuildPos, callsign, sizeof(callsign));
+            if (wins <= 0) continue;
+            bool keep = (wins > cutoff) || ((wins == cutoff) && atCutoff);
+            if (keep && nextSpill.addWins(callsign, wins))
+            {
+                if (wins == cutoff) atCutoff--;
+                noteBest(nextBest, wins, callsign);
+                continue;
+            }
+            // fewest wins, or no room - gone for good
+            forget(wins, callsign);
+            numDropped++;
+        }
+        if (rebuildPos < spill.slots()) return true;
+        finishRebuild();
+        return false;
+    }
+
+    // slices left in the current rebuild, 1 if one is due
+    size_t compactBacklog()
+    {
+        if (nextSpill.isOpen()) return (spill.slots() - rebuildPos + SPILLSLICE - 1) / SPILLSLICE;
+        return compactDue() ? 1 : 0;
+    }
+
+    size_t spillBytes() { return spill.bytes() + nextSpill.bytes(); }
+
+    // approximate heap use
+    size_t bytes()
+    {
+        size_t n = (leaderboard.size() + 2 * winnersList.size() + spillHist.size()) * NODEBYTES;
+        for (WinnersListType::const_iterator i = winnersList.begin(); i != winnersList.end(); ++i)
+        {
+            n += sizeof(Winner) + sizeof(const char *) + strlen(i->first) + 1;
+        }
+        n += (coldBest.size() + nextBest.size()) * (NODEBYTES + sizeof(int) + sizeof(string) + GGSHM_CALLSIGNLEN);
+        return n;
+    }
+
+    bool checkInvariants(string &why)
+    {
+        char msg[80];
+        if (maxWinners && (winnersList.size() > maxWinners))
+        {
+            snprintf(msg, sizeof(msg), "%d winners in memory, cap is %d", (int)winnersList.size(), (int)maxWinners);
+            why = msg;
+            return false;
+        }
+        if ((coldBest.size() > bestLimit()) || (nextBest.size() > bestLimit()))
+        {
+            snprintf(msg, sizeof(msg), "%d best cold winners kept, cap is %d", (int)coldBest.size(), (int)bestLimit());
+            why = msg;
+            return false;
+        }
+        size_t counted = 0;
+        for (map<int, size_t>::const_iterator h = spillHist.begin(); h != spillHist.end(); ++h) counted += h->second;
+        if (counted != spillCount)
+        {
+            snprintf(msg, sizeof(msg), "spill holds %d winners, by wins %d", (int)spillCount, (int)counted);
+            why = msg;
+            return false;
+        }
+        return true;
+    }
+
+    void report(int dest)
+    {
+        bz_sendTextMessagef(BZ_SERVER, dest, "winners: %d in memory (cap %d), %d in spill %s (cap %d, %d slots, %d KB mapped)",
+                            (int)winnersList.size(), (int)maxWinners, (int)spillCount,
+                            spill.isOpen() ? spill.getPath().c_str() : "-", (int)maxSpill, (int)spill.slots(),
+                            (int)(spillBytes() / 1024));
+        bz_sendTextMessagef(BZ_SERVER, dest, "winners: %lu spilled, %lu loaded back, %lu dropped, spill rebuilt %lu times%s, ranking holds %d, %d KB",
+                            numEvicted, numLoaded, numDropped, numCompacted,
+                            nextSpill.isOpen() ? " (rebuilding)" : "", (int)leaderboard.size(), (int)(bytes() / 1024));
+        if (global.stuck() || spill.stuck())
+        {
+            bz_sendTextMessagef(BZ_SERVER, dest, "winners: %d slots stuck mid-claim in %s, %d in spill - skipped",
+                                (int)global.stuck(), global.getPath().c_str(), (int)spill.stuck());
+        }
+    }
+
+private:
+    LeaderboardType leaderboard;
+    RecencyType recency;             // warm callsigns, least recently seen first
+    size_t maxWinners;               // _ggMaxWinners, 0 - no cap
+    size_t maxSpill;                 // _ggMaxSpill, 0 - no spill
+    string spillPath;                // _ggWinnersSpill
+    unsigned long numEvicted;
+    unsigned long numLoaded;
+    unsigned long numDropped;        // cold winners lost to a full spill
+    unsigned long numCompacted;
+
+    // what the spill holds, kept as it changes so nothing has to scan it
+    map<int, size_t> spillHist;      // callsigns by wins
+    size_t spillCount;               // callsigns with wins
+    ColdBestType coldBest;           // the best bestLimit() of them
+    size_t bestFor;                  // bestLimit() that coldBest was filled for
+
+    // a rebuild in progress copies spill into nextSpill, moving each
+    // callsign's wins so they are only ever in one of the two
+    WinnersTable nextSpill;
+    ColdBestType nextBest;           // coldBest as it will be after the rebuild
+    uint32_t rebuildPos;             // next spill slot to copy
+    int cutoff;                      // callsigns with fewer wins are dropped
+    size_t atCutoff;                 // and this many more with exactly that
+    bool rebuildFailed;              // couldn't open nextSpill - wait for a settings change
+    bool rankingDirty;
+
+    // rebuilt once it reaches the cap, it keeps 3/4 of it.  no more than
+    // 3/4 of the slots are ever in use, so probes stay short
+    static uint32_t slotsFor(size_t winners)
+    {
+        uint32_t slots = SPILLMINSLOTS;
+        while (slots < winners * 2) slots *= 2;
+        return slots;
+    }
+
+    size_t bestLimit()
+    {
+        return maxWinners ? maxWinners : maxSpill;
+    }
+
+    void trimBest(ColdBestType &best)
+    {
+        while (best.size() > bestLimit()) best.erase(best.begin());
+    }
+
+    void noteBest(ColdBestType &best, int wins, const char *callsign)
+    {
+        if ((best.size() >= bestLimit()) && (best.empty() || (wins <= best.begin()->first))) return;
+        best.insert(pair<int, string>(wins, callsign));
+        trimBest(best);
+    }
+
+    // a callsign's wins have left the spill (loaded back or dropped)
+    void forget(int wins, const char *callsign)
+    {
+        map<int, size_t>::iterator h = spillHist.find(wins);
+        if ((h != spillHist.end()) && !--h->second) spillHist.erase(h);
+        if (spillCount) spillCount--;
+        pair<int, string> entry(wins, callsign);
+        if (coldBest.erase(entry)) rankingDirty = true;
+        nextBest.erase(entry);
+    }
+
+    // past _ggMaxSpill the next rebuild drops the fewest wins, so this
+    // only fails if evictions outrun it by half the cap again (or there
+    // is no spill) - then these wins are the ones dropped
+    bool spillWins(const char *callsign, int wins)
+    {
+        if (wins <= 0) return true;
+        WinnersTable &table = nextSpill.isOpen() ? nextSpill : spill;
+        if ((spillCount >= maxSpill + maxSpill / 2) || !table.addWins(callsign, wins))
+        {
+            // coldBest can't vouch for the callsigns it passed over now
+            bestFor = 0;
+            return false;
+        }
+        spillHist[wins]++;
+        spillCount++;
+        size_t before = coldBest.size();
+        noteBest(coldBest, wins, callsign);
+        if (nextSpill.isOpen()) noteBest(nextBest, wins, callsign);
+        if (coldBest.size() != before) rankingDirty = true;
+        return true;
+    }
+
+    int takeSpilled(const char *callsign)
+    {
+        int wins = spill.takeWins(callsign) + nextSpill.takeWins(callsign);
+        if (wins > 0) forget(wins, callsign);
+        return wins;
+    }
+
+    bool compactDue()
+    {
+        if (!spill.isOpen() || rebuildFailed || !maxSpill) return false;
+        return (spill.getPath() != spillPath) || (spill.slots() != slotsFor(maxSpill)) ||
+               (spill.slotsUsed() * 4 >= spill.slots() * 3) || (spillCount >= maxSpill) ||
+               (bestFor < bestLimit());
+    }
+
+    // keep the most wins, up to 3/4 of the cap - ties at the cutoff are
+    // kept in slot order until the quota is used
+    bool startRebuild()
+    {
+        string nextPath = spillPath + ".next";
+        // still under that name if the last one couldn't be moved
+        if (nextPath == spill.getPath()) nextPath = spillPath;
+        if (!nextSpill.open(nextPath.c_str(), slotsFor(maxSpill), true))
+        {
+            nextSpill.close();
+            rebuildFailed = true;
+            return false;
+        }
+        size_t quota = maxSpill - maxSpill / 4;
+        cutoff = 0;
+        atCutoff = 0;
+        for (map<int, size_t>::reverse_iterator h = spillHist.rbegin(); h != spillHist.rend(); ++h)
+        {
+            if (h->second > quota)
+            {
+                cutoff = h->first;
+                atCutoff = quota;
+                break;
+            }
+            quota -= h->second;
+        }
+        nextBest.clear();
+        rebuildPos = 0;
+        return true;
+    }
+
+    void finishRebuild()
+    {
+        unsigned long dropped = numDropped;
+        unlink(spill.getPath().c_str());
+        spill.close();
+        if (!nextSpill.rename(spillPath.c_str()))
+        {
+            bz_debugMessagef(1, "GunGame: can't move spill to %s - left at %s", spillPath.c_str(), nextSpill.getPath().c_str());
+        }
+        spill.swap(nextSpill);
+        coldBest.swap(nextBest);
+        nextBest.clear();
+        bestFor = bestLimit();
+        numCompacted++;
+        rankingDirty = true;
+        if (cutoff > 0)
+        {
+            bz_debugMessagef(2, "GunGame: spill full - kept %d winners, those under %d wins were dropped (%lu so far)",
+                             (int)spillCount, cutoff, dropped);
+        }
+    }
+
+    // the callsign's entry, loaded back from the spill if it went cold
+    // end() if it has no wins and "create" is false
+    WinnersListType::iterator warm(const char *callsign, bool create)
+    {
+        if (!callsign || !*callsign) return winnersList.end();
+        WinnersListType::iterator i = winnersList.find(callsign);
+        if (i == winnersList.end())
+        {
+            int wins = takeSpilled(callsign);
+            if (!wins && !create) return i;
+            if (wins) numLoaded++;
+            Winner w;
+            w.wins = wins;
+            char *name = strdup(callsign);
+            w.recent = recency.insert(recency.end(), name);
+            i = winnersList.insert(pair<const char *, Winner>(name, w)).first;
+            rankingDirty = true;
+            // newest entry - never the one evicted
+            while (maxWinners && (winnersList.size() > maxWinners)) evict();
+            return i;
+        }
+        recency.splice(recency.end(), recency, i->second.recent);
+        return i;
+    }
+
+    // least recently seen winner goes to the spill
+    void evict()
+    {
+        WinnersListType::iterator cold = winnersList.find(recency.front());
+        char *callsign = const_cast<char *>(cold->first);
+        if (!spillWins(callsign, cold->second.wins))
+        {
+            numDropped++;
+            bz_debugMessagef(2, "GunGame: no room in the spill - %s's %d wins dropped", callsign, cold->second.wins);
+        }
+        recency.pop_front();
+        winnersList.erase(cold);
+        free(callsign);
+        numEvicted++;
+        rankingDirty = true;
+    }
+};
+
+class FlagManager : public FlagLadder
+{
+private:
+
+    typedef map<int, int> AssignedFlagsType;
+    struct DelayedFlagType{
+        DelayedFlagType(double t=0.0, const char *f=NULL)
+               : givetime(t), flag(f) {}
+        double givetime;
+        const char *flag;
+    };
+    struct PendingAdvance
+    {
+        int fromFlag;                // flag# held before this tick's kills
+        int kills;
+        double since;                // first of them
+    };
+    typedef map<int, PendingAdvance> PendingAdvancesType;
+
+    AssignedFlagsType assignedFlags; // flag# assigned by player ID
+    PendingAdvancesType pendingAdvances; // this tick's kills, by killer
+    map<int, int> resumeFlags;       // flag# to pick up at, by player ID (see resume())
+    double resumeMatchStart;         // their match's start, 0 if none
+    Scoreboard *scoreboard;          // total wins, shared by all arenas
+    Tracer *tracer;                  // the plugin's trace ring
+    GiveLatency *gives;              // how long flag gives take, all arenas
+
+    list<int> joinedPlayers;     // joined since last reconcile
+    int numParted;               // parted since last reconcile
+    string lastParted;           // callsign of latest to part
+    double reconcileTime;        // when pending joins/parts get applied (0 if none)
+    double matchStart;           // unix time the current match began (0 if none)
+    list<string> ladderLines;    // /flags, FLAGSPERLINE flags a line
+    string ladderCompact;        // /flags compact, one line
+
+    // the first join/part opens a window, anything else arriving
+    // before it closes is folded into the same reconcile
+    void rosterChanged()
+    {
+        if (reconcileTime <= 0.0)
+        {
+            reconcileTime = bz_getCurrentTime() + ROSTERSEC;
+        }
+    }
+
+    // if #flags enabled changes (as players come and go), update player scores
+    // handle case where a player has a flag now removed from circulation
+    void recalcScores()
+    {
+        for (AssignedFlagsType::iterator i = assignedFlags.begin(); i != assignedFlags.end(); ++i)
+        {
+            int playerID = i->first;
+            int flag = i->second;
+            FlagLevelsType::iterator j = flagLevels.find(flag);
+            if (j != flagLevels.end())
+            {
+                // current flag was still in the list
+                // just update the score with the new position
+                bz_setPlayerWins(playerID, j->second);
+            }
+            else
+            {
+                // player had a flag not in new list
+                // replace it with preceeding valid flag
+                int decr = 0;
+                int newFlagNo = getPrevFlag(flag, decr, 1);
+                j = flagLevels.find(newFlagNo);
+                if (j != flagLevels.end())
+                {
+                    i->second = newFlagNo; // update what flag the player *should* have
+                    bz_setPlayerWins(playerID, j->second);
+                    const char *newFlag = possibleFlags[newFlagNo].flagName;
+                    replaceFlagIfAlive(playerID, newFlag, "flag deactivated", GIVE_LADDER);
+                }
+                else
+                {
+                    // this should never happen
+                    bz_sendTextMessagef(BZ_SERVER, debuggerID, "ERROR: PREVIOUS FLAG NOT DEFINED");
+                }
+            }
+        }
+    }
+
+public:
+    // includes joins not yet reconciled
+    size_t rosterSize()
+    {
+        return assignedFlags.size();
+    }
+
+    // members accessed in plugin class
+    typedef map<int, DelayedFlagType> DelayedFlagsType;
+    DelayedFlagsType delayedFlags;
+    unsigned long multiKills[MULTIKILLMAX + 1];  // advances by kills in one tick
+    unsigned long multiKillsByFlag[MAXFLAGS];    // multi-kills by the flag they were made with
+    int debuggerID;
+    int arenaID;
+    static bool sharded;        // more than one arena on this server
+
+    FlagManager(int arena, Scoreboard *board, Tracer *t, GiveLatency *g)
+         : resumeMatchStart(0.0),
+           scoreboard(board),
+           tracer(t),
+           gives(g),
+           numParted(0),
+           reconcileTime(0.0),
+           matchStart(0.0),
+           debuggerID(BZ_ALLUSERS),
+           arenaID(arena)
+    {
+        memset(multiKills, 0, sizeof(multiKills));
+        memset(multiKillsByFlag, 0, sizeof(multiKillsByFlag));
+    }
+
+    // the ladder as chat lines, rebuilt only when the enabled flags change
+    void recalcFlags()
+    {
+        FlagLadder::recalcFlags();
+        ladderLines.clear();
+        string line;
+        char item[16];
+        int n = 0;
+        snprintf(item, sizeof(item), "%d flags:", (int)numEnabledFlags);
+        ladderCompact = item;
+        for (FlagLevelsType::const_iterator it = flagLevels.begin(); it != flagLevels.end(); ++it)
+        {
+            const char *flagName = possibleFlags[it->first].flagName;
+            snprintf(item, sizeof(item), "%s%d:%s", line.size() ? "  " : "", it->second, flagName);
+            line += item;
+            ladderCompact += " ";
+            ladderCompact += flagName;
+            if (++n % FLAGSPERLINE == 0)
+            {
+                ladderLines.push_back(line);
+                line.clear();
+            }
+        }
+        if (line.size()) ladderLines.push_back(line);
+    }
+
+    // with more than one arena, "everyone" means everyone in this arena
+    void tellf(int dest, const char *fmt, ...)
+    {
+        char buf[256];
+        char *msg = buf;
+        va_list args;
+        va_start(args, fmt);
+        int len = vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        // leader and ladder lines can run long - don't cut them off
+        string longMsg;
+        if (len >= (int)sizeof(buf))
+        {
+            longMsg.resize(len + 1);
+            va_start(args, fmt);
+            vsnprintf(&longMsg[0], len + 1, fmt, args);
+            va_end(args);
+            msg = &longMsg[0];
+        }
+
+        if ((dest != BZ_ALLUSERS) || !sharded)
+        {
+            bz_sendTextMessage(BZ_SERVER, dest, msg);
+            return;
+        }
+        for (AssignedFlagsType::const_iterator i = assignedFlags.begin(); i != assignedFlags.end(); ++i)
+        {
+            bz_sendTextMessage(BZ_SERVER, i->first, msg);
+        }
+    }
+
+    // membership changes are only recorded here - ladder and score work
+    // waits for reconcileRoster() so a burst of joins/parts is handled once
+    void addPlayer(const bz_PlayerJoinPartEventData_V1 *joinData)
+    {
+        const char *newGuy = bz_getPlayerCallsign(joinData->playerID);
+        bz_sendTextMessagef(BZ_SERVER, joinData->playerID, 
+                            "Welcome to \"GunGame Style\", %s...",
+                            newGuy);
+
+        if (gameOn())
+        {
+            // game already in progress - start at the bottom right away
+            // so a spawn before the next reconcile still gets a flag
+            assignedFlags[joinData->playerID] = firstFlag;
+            bz_setPlayerWins(joinData->playerID, 1);
+            bz_setPlayerLosses(joinData->playerID, 0);
+            bz_setPlayerTKs(joinData->playerID, 0);
+        }
+        else
+        {
+            // no game yet
+            assignedFlags[joinData->playerID] = -1;
+        }
+        joinedPlayers.push_back(joinData->playerID);
+        rosterChanged();
+    }
+
+    void removePlayer(const bz_PlayerJoinPartEventData_V1 *partData)
+    {
+        assignedFlags.erase(partData->playerID);
+        delayedFlags.erase(partData->playerID);
+        pendingAdvances.erase(partData->playerID);
+        resumeFlags.erase(partData->playerID);
+        joinedPlayers.remove(partData->playerID);
+        numParted++;
+        lastParted = bz_getPlayerCallsign(partData->playerID);
+        rosterChanged();
+    }
+
+    bool reconcileDue(double now)
+    {
+        return (reconcileTime > 0.0) && (now >= reconcileTime);
+    }
+
+    // apply all joins/parts since the last reconcile in one pass
+    // returns 1 if this starts a game, -1 if it suspends one, 0 otherwise
+    int reconcileRoster()
+    {
+        int change = 0;
+        bool wasGameOn = gameOn();
+        int oldNumFlags = numEnabledFlags;
+        int numJoined = joinedPlayers.size();
+
+        // players present is the truth - no running count to drift
+        if (wasGameOn && (assignedFlags.size() < minPlayers)) announceLeaders(BZ_ALLUSERS);
+        numPlayers = assignedFlags.size();
+        recalcFlags();
+
+        if (gameOn())
+        {
+            int numFlags = numEnabledFlags;
+            if (!wasGameOn)
+            {
+                beginGG();
+                change = 1;
+                tellf(BZ_ALLUSERS, 
+                            "\"GunGame Style\" started with %d players %d flags",
+                            numPlayers, numFlags);
+                listFlags();
+                tellf(BZ_ALLUSERS,
+                            "Commands: \"flags\", \"winners\", \"leaders\"");
+                resumePlayers(true);
+            }
+            else
+            {
+                // game continues. tell new players the flag list
+                for (list<int>::const_iterator i = joinedPlayers.begin(); i != joinedPlayers.end(); ++i)
+                {
+                    listFlags(*i);
+                }
+                if (oldNumFlags != numFlags)
+                {
+                    // adjust scores to map to new flags
+                    recalcScores();
+                }
+                tellf(BZ_ALLUSERS,
+                            "\"GunGame Style\": %d joined, %d left - %d players, %d flags to win",
+                            numJoined, numParted, numPlayers, numFlags);
+                resumePlayers(false);
+            }
+        }
+        else if (wasGameOn)
+        {
+            tellf(BZ_ALLUSERS, 
+                               "\"GunGame Style\" suspended - thanks a lot \"%s\"!",
+                               lastParted.c_str());
+            endGG();
+            change = -1;
+            tellf(BZ_ALLUSERS, 
+                               "\"GunGame Style\" needs %d more player%s to restart...",
+                               numPlayersNeeded(), (numPlayersNeeded() > 1) ? "s": "");
+        }
+        else
+        {
+            // no game yet
+            int needed = numPlayersNeeded();
+            tellf(BZ_ALLUSERS, 
+                                "\"GunGame Style\" awaiting %d more player%s...",
+                                needed, (needed > 1) ? "s": "");
+        }
+
+        joinedPlayers.clear();
+        numParted = 0;
+        reconcileTime = 0.0;
+        return change;
+    }
+
+    // a player coming back to a match this server took over as a standby
+    // - they pick up at their old flag once the game is on here
+    void resume(int playerID, int flag, double start)
+    {
+        resumeFlags[playerID] = flag;
+        if ((start > 0.0) && ((resumeMatchStart <= 0.0) || (start < resumeMatchStart))) resumeMatchStart = start;
+    }
+
+    // if the game only just began here, it is their old match carrying on
+    void resumePlayers(bool begun)
+    {
+        if (resumeFlags.empty()) return;
+        if (begun && (resumeMatchStart > 0.0)) matchStart = resumeMatchStart;
+        for (map<int, int>::const_iterator r = resumeFlags.begin(); r != resumeFlags.end(); ++r)
+        {
+            AssignedFlagsType::iterator i = assignedFlags.find(r->first);
+            if (i == assignedFlags.end()) continue;
+            // the ladder may be shorter with fewer players back
+            int flag = r->second;
+            if (flagLevel(flag) <= 0)
+            {
+                int decr = 0;
+                flag = getPrevFlag(flag, decr, 1);
+            }
+            if ((flag < 0) || (flagLevel(flag) <= 0)) flag = firstFlag;
+            i->second = flag;
+            bz_setPlayerWins(r->first, flagLevel(flag));
+            const char *flagName = possibleFlags[flag].flagName;
+            bz_sendTextMessagef(BZ_SERVER, r->first, "Welcome back - picking up with %s (%d/%d)",
+                                flagName, flagLevel(flag), (int)numEnabledFlags);
+            replaceFlagIfAlive(r->first, flagName, "resumed", GIVE_LADDER, true);
+        }
+        resumeFlags.clear();
+        resumeMatchStart = 0.0;
+    }
+
+    // sometimes a flag give fails (for example if we just took it)
+    // handle this with a delayed give
+    // tries the first due give at or after player ID "from"
+    // returns the player ID handled, or -1 if nothing is due
+    int giveNextDelayedFlag(int from, double now)
+    {
+        for (DelayedFlagsType::iterator i = delayedFlags.lower_bound(from); i != delayedFlags.end(); ++i)
+        {
+            if (i->second.flag)
+            {
+                if (now > i->second.givetime)
+                {
+                // timer has expired - try to give the flag now
+                // if that still fails, reset timer
+                    int playerID = i->first;
+                    if (givePlayerFlagNow(playerID, i->second.flag))
+                    {
+                        // done - nothing lingers until the player leaves
+                        delayedFlags.erase(i);
+                    }
+                    else
+                    {
+                        i->second.givetime = now + RETRYSEC;
+                    }
+                    return playerID;
+                }
+            }
+        }
+        return -1;
+    }
+
+    size_t numPendingAdvances() { return pendingAdvances.size(); }
+
+    size_t numDelayedFlags()
+    {
+        size_t n = 0;
+        for (DelayedFlagsType::const_iterator i = delayedFlags.begin(); i != delayedFlags.end(); ++i)
+        {
+            if (i->second.flag) n++;
+        }
+        return n;
+    }
+
+    void givePlayerFlagDelayed(int playerID, const char *flagName)
+    {
+        double now = bz_getCurrentTime();
+        delayedFlags[playerID].flag = flagName;
+        delayedFlags[playerID].givetime = now + DELAYSEC;
+    }
+
+    bool givePlayerFlagNow(int playerID, const char *flagName)
+    {
+        bool ok = bz_givePlayerFlag(playerID, flagName, true);
+        gives->gave(playerID, flagName, ok, numPlayers, bz_getCurrentTime());
+        return ok;
+    }
+
+    // returns True if flag give succeeded immediately
+    // otherwise queues it up and returns False
+    bool givePlayerFlag(int playerID, const char *flagName)
+    {
+        bool now = givePlayerFlagNow(playerID, flagName);
+        if (now) return true;
+        givePlayerFlagDelayed(playerID, flagName);
+        return false;
+    }
+
+    // cause and since (the trigger's time, now if 0) are for gives
+    void replaceFlagIfAlive(int playerID, const char *flagName, const char *reason, int cause,
+                            bool tryFast=false, double since=0.0)
+    {
+         bz_BasePlayerRecord *pr = bz_getPlayerByIndex(playerID);
+         if (pr)
+         {
              if (pr->spawned) 
              {
                  bz_removePlayerFlag(playerID);
                  if (flagName)
                  {
+                     gives->begin(playerID, cause, (since > 0.0) ? since : bz_getCurrentTime());
                      if (tryFast) 
                          givePlayerFlag(playerID, flagName);
                      else
@@ -445,383 +1826,2518 @@ public:
          bz_freePlayerRecord(pr);
     }
 
-    void beginGG()
+    void beginGG()
+    {
+        matchStart = wallClock();
+        // new game -- pass out flags to anyone spawned
+        const char *firstFlagName = possibleFlags[firstFlag].flagName;
+#ifdef PLAYSOUNDS
+        bz_sendPlayCustomLocalSound(BZ_ALLUSERS, "gungame/gungame_start");
+#endif
+            
+        bz_BasePlayerRecord *pr = NULL;
+        for (AssignedFlagsType::iterator i = assignedFlags.begin(); i != assignedFlags.end(); ++i)
+        {
+            int playerID = i->first;
+            i->second = firstFlag;
+            bz_setPlayerWins(playerID, 1);
+            bz_setPlayerLosses(playerID, 0);
+            bz_setPlayerTKs(playerID, 0);
+            replaceFlagIfAlive(playerID, firstFlagName, "game begin", GIVE_LADDER, true);
+        }
+    }
+
+    void endGG()
+    {
+        matchStart = 0.0;
+        for (AssignedFlagsType::iterator i = assignedFlags.begin(); i != assignedFlags.end(); ++i)
+        {
+            // reset flag and scores
+            int playerID = i->first;
+            i->second = -1;
+            bz_setPlayerWins(playerID, 0);
+            bz_setPlayerLosses(playerID, 0);
+            bz_setPlayerTKs(playerID, 0);
+            
+            replaceFlagIfAlive(playerID, NULL, "game end", GIVE_LADDER);
+        }
+    }
+
+    // this arena's part of the shared memory snapshot
+    void publish(GGShmState &state)
+    {
+        GGShmArena &a = state.arenas[arenaID];
+        a.active = 1;
+        a.gameOn = gameOn();
+        a.numPlayers = assignedFlags.size();
+        a.numLevels = numEnabledFlags;
+        memset(a.ladder, 0, sizeof(a.ladder));
+        for (FlagLevelsType::const_iterator i = flagLevels.begin(); i != flagLevels.end(); ++i)
+        {
+            if (i->second <= GGSHM_MAXFLAGS)
+            {
+                strncpy(a.ladder[i->second - 1], possibleFlags[i->first].flagName, GGSHM_FLAGLEN - 1);
+            }
+        }
+        a.matchStart = matchStart;
+
+        int maxFlag = -1;
+        a.numLeaders = 0;
+        for (AssignedFlagsType::const_iterator i = assignedFlags.begin(); i != assignedFlags.end(); ++i)
+        {
+            int playerID = i->first;
+            int flag = i->second;
+            if (flag > maxFlag)
+            {
+                maxFlag = flag;
+                a.numLeaders = 0;
+            }
+            if ((flag == maxFlag) && (a.numLeaders < GGSHM_MAXLEADERS))
+            {
+                a.leaders[a.numLeaders++] = playerID;
+            }
+
+            if (state.numPlayers >= GGSHM_MAXPLAYERS) continue;
+            GGShmPlayer &p = state.players[state.numPlayers++];
+            const char *callsign = bz_getPlayerCallsign(playerID);
+            memset(&p, 0, sizeof(p));
+            p.playerID = playerID;
+            p.arena = arenaID;
+            p.flag = flag;
+            p.level = flagLevel(flag);
+            p.wins = scoreboard->winsFor(callsign);
+            if (callsign) strncpy(p.callsign, callsign, GGSHM_CALLSIGNLEN - 1);
+            if (flag >= 0) strncpy(p.flagName, possibleFlags[flag].flagName, GGSHM_FLAGLEN - 1);
+        }
+        a.leaderLevel = (maxFlag > firstFlag) ? flagLevel(maxFlag) : 0;
+        if (!a.leaderLevel) a.numLeaders = 0;
+    }
+
+    void listFlags(int dest=BZ_ALLUSERS, bool compact=false)
+    {
+        if (compact)
+        {
+            tellf(dest, "%s", ladderCompact.c_str());
+            return;
+        }
+        for (list<string>::const_iterator it = ladderLines.begin(); it != ladderLines.end(); ++it)
+        {
+            tellf(dest, "%s", it->c_str());
+        }
+    }
+
+    // one page of the local and the cross-server scoreboards
+    void announceWinners(int dest, int page=1)
+    {
+        const Scoreboard::LeaderboardType &leaderboard = scoreboard->ranking();
+        WinnersTable::RankingType globalRanking;
+        scoreboard->global.ranking(globalRanking);
+        if (!leaderboard.size() && !globalRanking.size())
+        {
+            tellf(dest, "No wins yet...");
+            return;
+        }
+        int numPages = (max(leaderboard.size(), globalRanking.size()) + WINNERSPAGE - 1) / WINNERSPAGE;
+        if ((page < 1) || (page > numPages))
+        {
+            tellf(dest, "Winners has %d page%s", numPages, (numPages > 1) ? "s":"");
+            return;
+        }
+        size_t first = (size_t)(page - 1) * WINNERSPAGE;
+        if (first < leaderboard.size())
+        {
+            tellf(dest, "-= S C O R E B O A R D =-");
+            Scoreboard::LeaderboardType::const_iterator j = leaderboard.begin();
+            for (size_t n = 0; n < first; ++n) ++j;
+            for (int n = 0; (n < WINNERSPAGE) && (j != leaderboard.end()); ++n, ++j)
+            {
+                tellf(dest, "%d win%s - %s",
+                                    j->first, 
+                                    (j->first > 1) ? "s":"",
+                                    j->second);
+            }
+        }
+        if (first < globalRanking.size())
+        {
+            tellf(dest, "-= A L L   S E R V E R S =-");
+            WinnersTable::RankingType::const_iterator j = globalRanking.begin();
+            for (size_t n = 0; n < first; ++n) ++j;
+            for (size_t rank = first; (rank < first + WINNERSPAGE) && (j != globalRanking.end()); ++j)
+            {
+                tellf(dest, "#%d %d win%s - %s", (int)++rank, j->first, (j->first > 1) ? "s":"", j->second.c_str());
+            }
+        }
+        if (numPages > 1)
+        {
+            tellf(dest, "page %d of %d - \"/winners <page>\" for more", page, numPages);
+        }
+    }
+
+    void announceLeaders(int dest)
+    {
+        int maxFlag = -1;
+        list<int> quasiWinners;
+        for (AssignedFlagsType::const_iterator i = assignedFlags.begin(); i != assignedFlags.end(); ++i)
+        {
+            int playerID = i->first;
+            int flag = i->second;
+            if (flag > maxFlag)
+            {
+                quasiWinners.clear();
+                quasiWinners.push_back(playerID);
+                maxFlag = flag;
+            }
+            else if (flag == maxFlag)
+            {
+                quasiWinners.push_back(playerID);
+            }
+        }
+    
+        // announce "quasi winners"
+        if (maxFlag > firstFlag)
+        {
+            string qwinners = "";
+            for(list<int>::const_iterator i = quasiWinners.begin();
+                i != quasiWinners.end(); 
+                ++i)
+            {
+                qwinners += bz_getPlayerCallsign(*i);
+                qwinners += ", ";
+            }
+            qwinners = qwinners.substr(0, qwinners.length() - 2);
+            
+            const char *lastFlag = possibleFlags[maxFlag].flagName;
+            tellf(dest,
+                                "Leading the pack: %s with %s",
+                                qwinners.c_str(), lastFlag);
+        }
+        else
+        {
+            tellf(dest,
+                                "No leaders yet.  Shoot something!");
+        }
+    }
+
+    // players at the last flag who can only win by crushing someone
+    void endgamePlayers(list<int> &out)
+    {
+        if (!gameOn() || (numPlayers < REQUIRECRUSH)) return;
+        for (AssignedFlagsType::const_iterator i = assignedFlags.begin(); i != assignedFlags.end(); ++i)
+        {
+            if (i->second == lastFlag) out.push_back(i->first);
+        }
+    }
+
+    // approximate heap use of the per-player maps and the ladder text
+    size_t bytes()
+    {
+        size_t n = (assignedFlags.size() + delayedFlags.size() + flagLevels.size() + joinedPlayers.size()) * NODEBYTES;
+        n += pendingAdvances.size() * (NODEBYTES + sizeof(int) + sizeof(PendingAdvance));
+        n += assignedFlags.size() * 2 * sizeof(int) + delayedFlags.size() * (sizeof(int) + sizeof(DelayedFlagType));
+        n += flagLevels.size() * (sizeof(size_t) + sizeof(int)) + joinedPlayers.size() * sizeof(int);
+        for (list<string>::const_iterator it = ladderLines.begin(); it != ladderLines.end(); ++it)
+        {
+            n += NODEBYTES + sizeof(string) + it->capacity() + 1;
+        }
+        return n + ladderCompact.capacity() + 1 + lastParted.capacity() + 1;
+    }
+
+    bool hasPlayer(int playerID)
+    {
+        return assignedFlags.find(playerID) != assignedFlags.end();
+    }
+
+    // state that should always hold between events (tools/ggsoak checks
+    // it after every one) - false with the reason if something drifted
+    bool checkInvariants(string &why)
+    {
+        char msg[160];
+        if ((reconcileTime <= 0.0) && (numPlayers != assignedFlags.size()))
+        {
+            snprintf(msg, sizeof(msg), "numPlayers %d but %d players assigned", (int)numPlayers, (int)assignedFlags.size());
+            why = msg;
+            return false;
+        }
+        if (numEnabledFlags != flagLevels.size())
+        {
+            snprintf(msg, sizeof(msg), "%d flags enabled but %d levels", (int)numEnabledFlags, (int)flagLevels.size());
+            why = msg;
+            return false;
+        }
+        bool on = gameOn();
+        for (AssignedFlagsType::const_iterator i = assignedFlags.begin(); i != assignedFlags.end(); ++i)
+        {
+            int level = flagLevel(i->second);
+            if (on && !level)
+                snprintf(msg, sizeof(msg), "player %d has flag %d, which is not enabled", i->first, i->second);
+            else if (on && (bz_getPlayerWins(i->first) != level))
+                snprintf(msg, sizeof(msg), "player %d shows %d wins at level %d", i->first, bz_getPlayerWins(i->first), level);
+            else if (!on && (i->second != -1))
+                snprintf(msg, sizeof(msg), "player %d has flag %d with no game on", i->first, i->second);
+            else
+                continue;
+            why = msg;
+            return false;
+        }
+        for (DelayedFlagsType::const_iterator i = delayedFlags.begin(); i != delayedFlags.end(); ++i)
+        {
+            if (!hasPlayer(i->first))
+            {
+                snprintf(msg, sizeof(msg), "pending give for departed player %d", i->first);
+                why = msg;
+                return false;
+            }
+        }
+        for (PendingAdvancesType::const_iterator i = pendingAdvances.begin(); i != pendingAdvances.end(); ++i)
+        {
+            if (!hasPlayer(i->first))
+            {
+                snprintf(msg, sizeof(msg), "pending advance for departed player %d", i->first);
+                why = msg;
+                return false;
+            }
+        }
+        for (map<int, int>::const_iterator i = resumeFlags.begin(); i != resumeFlags.end(); ++i)
+        {
+            if (!hasPlayer(i->first))
+            {
+                snprintf(msg, sizeof(msg), "resume for departed player %d", i->first);
+                why = msg;
+                return false;
+            }
+        }
+        for (list<int>::const_iterator i = joinedPlayers.begin(); i != joinedPlayers.end(); ++i)
+        {
+            if (!hasPlayer(*i))
+            {
+                snprintf(msg, sizeof(msg), "departed player %d waiting to be reconciled", *i);
+                why = msg;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // flag# the player should have, -1 if none
+    int getAssignedFlagNo(const int playerID)
+    {
+        AssignedFlagsType::const_iterator i = assignedFlags.find(playerID);
+        return (i == assignedFlags.end()) ? -1 : i->second;
+    }
+
+    // flag# the player holds right now - a kill moves them up the ladder
+    // at once, but their flag only changes in applyAdvances()
+    int getHeldFlagNo(const int playerID)
+    {
+        int flag = getAssignedFlagNo(playerID);
+        PendingAdvancesType::const_iterator p = pendingAdvances.find(playerID);
+        if ((p != pendingAdvances.end()) && (flagLevel(flag) > flagLevel(p->second.fromFlag)))
+        {
+            return p->second.fromFlag;
+        }
+        return flag;
+    }
+
+    const char *getAssignedFlag(const int playerID)
+    {
+        AssignedFlagsType::const_iterator i = assignedFlags.find(playerID);
+        if ((i == assignedFlags.end()) || (i->second < 0))
+        {
+            return NULL;
+        }
+        return possibleFlags[i->second].flagName;
+    }
+
+    // once per tick, first thing on the scheduler - one flag swap, score and
+    // message for each player who advanced, however many they killed
+    void applyAdvances()
+    {
+        for (PendingAdvancesType::const_iterator p = pendingAdvances.begin(); p != pendingAdvances.end(); ++p)
+        {
+            int killerID = p->first;
+            countAdvance(killerID, p->second);
+
+            // demoted or reset since (suicide, cheat, ladder change) - the
+            // flag was swapped then if it had to be
+            AssignedFlagsType::const_iterator i = assignedFlags.find(killerID);
+            if (!gameOn() || (i == assignedFlags.end())) continue;
+            int newFlagNo = i->second;
+            int newLevel = flagLevel(newFlagNo);
+            if (newLevel <= flagLevel(p->second.fromFlag)) continue;
+
+            const char *killerName = bz_getPlayerCallsign(killerID);
+            int maxLevel = numEnabledFlags;
+            int remainLevels = maxLevel - newLevel + 1;
+            if (remainLevels <= MAJORWARN)
+            {
+#ifdef PLAYSOUNDS
+                bz_sendPlayCustomLocalSound(BZ_ALLUSERS, "flag_alert");
+#endif
+                tellf(BZ_ALLUSERS, 
+                                    "--->>> ATTENTION: %s is ABOUT TO WIN!!! <<<---",
+                                    killerName);
+            }
+            else if (remainLevels <= MINORWARN)
+            {
+#ifdef PLAYSOUNDS
+                bz_sendPlayCustomLocalSound(BZ_ALLUSERS, "lock");
+#endif
+                tellf(BZ_ALLUSERS,
+                                    "-> ATTENTION: %s has %d KILLS REMAINING!!! <-",
+                                    killerName, remainLevels);
+            }
+
+            // kills were counted as they happened - this only repairs drift
+            bz_setPlayerWins(killerID, newLevel);
+            const char *killerFlag = possibleFlags[p->second.fromFlag].flagName;
+            const char *newFlag = possibleFlags[newFlagNo].flagName;
+            if (p->second.kills > 1)
+            {
+                bz_sendTextMessagef(BZ_SERVER, killerID, "\"Upgraded\" from %s to %s (%d/%d) - %d kills at once!",
+                                    killerFlag, newFlag, newLevel, maxLevel, p->second.kills);
+            }
+            else
+            {
+                bz_sendTextMessagef(BZ_SERVER, killerID, "\"Upgraded\" from %s to %s (%d/%d)", killerFlag, newFlag, newLevel, maxLevel);
+            }
+#ifdef PLAYSOUNDS
+            bz_sendPlayCustomLocalSound(killerID, "gungame/gungame_boost");
+#endif
+            replaceFlagIfAlive(killerID, newFlag, "advancing", GIVE_KILL, false, p->second.since);
+        }
+        pendingAdvances.clear();
+    }
+
+    // multi-kill counts, from the ladder's point of view
+    void countAdvance(int killerID, const PendingAdvance &advance)
+    {
+        multiKills[min(advance.kills, MULTIKILLMAX)]++;
+        if (advance.kills > 1)
+        {
+            if ((advance.fromFlag >= 0) && (advance.fromFlag < MAXFLAGS)) multiKillsByFlag[advance.fromFlag]++;
+            TRACE_INFO(TRACE_LADDER, TE_MULTIKILL, killerID, advance.kills, 0, possibleFlags[advance.fromFlag].flagName, NULL);
+        }
+    }
+
+    // suicide or natural causes
+    void handleSuicide(const bz_PlayerDieEventData_V1 *dieData)
+    {
+        const char *victimName = bz_getPlayerCallsign(dieData->playerID);
+        int victimFlagNo = assignedFlags[dieData->playerID];
+        const char *victimFlag = possibleFlags[victimFlagNo].flagName;
+
+        int decr = 0;
+        int newFlagNo = getPrevFlag(victimFlagNo, decr, bz_getBZDBInt("_ggSuicidePenalty"));
+        if (newFlagNo < 0)
+        {
+            newFlagNo = victimFlagNo;
+        }
+        const char *newFlag = possibleFlags[newFlagNo].flagName;
+#ifdef PLAYSOUNDS
+        bz_sendPlayCustomLocalSound(BZ_ALLUSERS, "flag_lost");
+#endif
+        bz_sendTextMessagef(BZ_SERVER, dieData->playerID, "Ha-Ha!  You suicided with %s.  %s %s",
+                            victimFlag,
+                            (newFlagNo <= firstFlag) ? "starting over with"
+                                                                 : "demoted to",
+                            newFlag);
+        assignedFlags[dieData->playerID] = newFlagNo;
+        gives->expect(dieData->playerID, GIVE_DEMOTE);
+
+        // reduce player score on suicide
+        if (decr)
+        {
+            bz_setPlayerWins(dieData->playerID, flagLevel(newFlagNo));
+        }
+    }
+
+    void handleHomicide(bz_PlayerDieEventData_V1 *dieData)
+    {
+        // on noes! a homicide occurred
+        int killerID = dieData->killerID;
+        int victimID = dieData->playerID;
+        const char *victimName = bz_getPlayerCallsign(victimID);
+        const char *killerName = bz_getPlayerCallsign(killerID);
+        int victimFlagNo = assignedFlags[victimID];
+        int killerFlagNo = assignedFlags[dieData->killerID];
+        const char *victimFlag = possibleFlags[victimFlagNo].flagName;
+        const char *killerFlag = possibleFlags[killerFlagNo].flagName;
+
+        // if someone spams the drop flag key and squeezes of a shot with no flag
+        // ... and if we don't succeed in making the bullet PZ
+        // ... and this results in another player dying
+        // demote and publicly shame the "cheater"
+        //
+        // allow valid cases where flagKilledWith can be empty:
+        //  1 killer has SR (squish)
+        //  2 victim has BU (squish)
+        //  3 victim "just had" BU
+        bool cheat = false;
+        if (bz_getBZDBBool("_ggDetectCheat"))
+        {
+            // was there no flag?
+            if (dieData->flagKilledWith.size() == 0)
+            {
+                // world weapon and server kills never get here
+                if ((string(killerFlag) != "SR") && (string(victimFlag) != "BU"))
+                {
+                    TRACE_WARN(TRACE_CHEAT, TE_KILLNOFLAG, killerID, 0, 0, NULL, NULL);
+                    // if victim Z < 0, was coming out of BU -- not a cheat
+                    if (dieData->state.pos[2] >= 0)
+                    {
+                        // this is as sure as we can be that "cheat" happened
+                        cheat = true;
+                        int decr = 0;
+                        int newFlagNo = getPrevFlag(killerFlagNo, decr, bz_getBZDBInt("_ggCheatPenalty"));
+                        if (newFlagNo < 0)
+                        {
+                            newFlagNo = firstFlag;
+                        }
+                        const char *newFlag = possibleFlags[newFlagNo].flagName;
+                        tellf(BZ_ALLUSERS, "%s killed %s ... WITHOUT holding %s!  Booted to %s",
+                                            killerName, victimName, killerFlag, newFlag);
+                        assignedFlags[killerID] = newFlagNo;
+                        // negate cheater score increase
+                        // and roll it back 
+                        bz_setPlayerWins(killerID, flagLevel(newFlagNo) - 1);
+                        // if cheater died, do nothing - new flag will be given on spawn
+                        replaceFlagIfAlive(killerID, newFlag, "suspected cheat", GIVE_DEMOTE, true);
+                    }
+                }
+            }
+        }
+        if (!cheat)
+        {
+            // legit kill!
+            if (bz_getBZDBBool("_ggJacked"))
+            {
+                tellf(BZ_ALLUSERS, "%s got JACKED by %s with %s",
+                                    victimName, killerName, killerFlag);
+            }
+
+            int killerLevel = flagLevel(killerFlagNo);
+            int maxLevel = numEnabledFlags;
+
+            // advance the killer... detect win case, etc
+            if (killerLevel < maxLevel)
+            {
+                int adv = 0;
+                int newFlagNo = getNextFlag(killerFlagNo, adv, 1);
+                TRACE_INFO(TRACE_LADDER, TE_ADVANCE, killerID, newFlagNo, flagLevel(newFlagNo), NULL, NULL);
+                assignedFlags[killerID] = newFlagNo;
+
+                // the server counts the kill towards the score by itself
+                // the flag swap and message wait for applyAdvances(), in case
+                // the same shot takes out more players this tick
+                PendingAdvancesType::iterator p = pendingAdvances.find(killerID);
+                if (p == pendingAdvances.end())
+                {
+                    PendingAdvance pending;
+                    pending.fromFlag = killerFlagNo;
+                    pending.kills = 0;
+                    pending.since = bz_getCurrentTime();
+                    p = pendingAdvances.insert(pair<int, PendingAdvance>(killerID, pending)).first;
+                }
+                p->second.kills++;
+            }
+            else
+            {
+                // winner!
+                PendingAdvance last;
+                last.fromFlag = killerFlagNo;
+                last.kills = 1;
+                last.since = bz_getCurrentTime();
+                PendingAdvancesType::iterator p = pendingAdvances.find(killerID);
+                if (p != pendingAdvances.end())
+                {
+                    // won on a multi-kill
+                    last = p->second;
+                    last.kills++;
+                }
+                countAdvance(killerID, last);
+                pendingAdvances.clear();
+                tellf(BZ_ALLUSERS, "---===>>> WINNER: %s <<<===---",
+                                    killerName);
+                scoreboard->addWinner(killerName);
+                announceWinners(BZ_ALLUSERS);
+
+                // reset game
+                matchStart = wallClock();
+                int winnerFlag = assignedFlags[killerID];
+                int firstFlag = getNextFlag(-1);
+                const char *firstFlagName = possibleFlags[firstFlag].flagName;
+                for (AssignedFlagsType::iterator i = assignedFlags.begin(); i!= assignedFlags.end(); ++i)
+                {
+                    int playerID = i->first;
+                    int flag = i->second;
+                    // reset scores
+                    // level 1 for everyone - the winner's will increment to 1 due to kill
+                    bz_setPlayerWins(playerID, (playerID == killerID) ? 0 : 1);
+                    bz_setPlayerLosses(i->first, 0);
+                    bz_setPlayerTKs(i->first, 0);
+                    i->second = firstFlag;
+                    if (playerID != killerID)
+                    {
+                        if (flag == winnerFlag)
+                        {
+#ifdef PLAYSOUNDS
+                            bz_sendPlayCustomLocalSound(playerID, "phantom");
+                            bz_sendPlayCustomLocalSound(playerID, "flag_won");
+#endif
+                            bz_sendTextMessagef(BZ_SERVER, playerID, "So close!  %s just beat you", killerName);
+                        }
+                        else
+                        {
+#ifdef PLAYSOUNDS
+                            bz_sendPlayCustomLocalSound(playerID, "flag_won");
+#endif
+                            bz_sendTextMessagef(BZ_SERVER, playerID, "Bow to %s", killerName);
+                        }
+                        // kill all non-winners
+                        // spawn will reset their flag
+                        bz_killPlayer(playerID, false);
+                    }
+                    else
+                    {
+#ifdef PLAYSOUNDS
+                        bz_sendPlayCustomLocalSound(playerID, "gungame/gungame_sexy");
+                        bz_sendPlayCustomLocalSound(playerID, "flag_won");
+#endif
+                        bz_sendTextMessagef(BZ_SERVER, playerID, "Nice game %s!", killerName);
+                        replaceFlagIfAlive(playerID, firstFlagName, "winning", GIVE_LADDER);
+                    }
+                }
+            }
+        }
+    }
+};
+
+bool FlagManager::sharded = false;
+
+// drop-shoot detection as it happens, rather than after a kill
+// keeps the last few drops/re-gives/shots per player in fixed rings
+// and scores a player up when a shot follows a drop too closely, or
+// when their drops and shots fall into a steady rhythm
+// suspicion decays over time, so one unlucky drop doesn't stick
+class CheatWatch
+{
+private:
+    struct PlayerEvents
+    {
+        double drops[EVENTRING];
+        double gives[EVENTRING];
+        double shots[EVENTRING];
+        unsigned int numDrops;       // total recorded (ring index = n % EVENTRING)
+        unsigned int numGives;
+        unsigned int numShots;
+        double suspicion;
+        double suspicionTime;        // when suspicion was last decayed
+        unsigned int dropShots;      // shots inside the window after a drop
+        unsigned int rhythms;        // drop/shot rhythms seen
+        bool flagged;                // reported, not yet faded back under half the threshold
+    };
+
+    PlayerEvents players[MAXPLAYERS];
+
+    static double last(const double *ring, unsigned int n)
+    {
+        return n ? ring[(n - 1) % EVENTRING] : -1.0;
+    }
+
+    void decay(PlayerEvents &pe, double now)
+    {
+        if (pe.suspicion > 0.0)
+        {
+            pe.suspicion *= exp(-(now - pe.suspicionTime) / SUSPICIONDECAY);
+        }
+        pe.suspicionTime = now;
+    }
+
+    // every drop still in the ring was followed by a shot inside the
+    // window, and the drops are evenly spaced
+    bool rhythm(const PlayerEvents &pe)
+    {
+        if (pe.numDrops < EVENTRING || pe.numShots < EVENTRING) return false;
+
+        double gapSum = 0.0, gapSq = 0.0;
+        for (unsigned int d = pe.numDrops - EVENTRING; d < pe.numDrops; ++d)
+        {
+            double drop = pe.drops[d % EVENTRING];
+            bool shotAfter = false;
+            for (unsigned int s = 0; s < EVENTRING && !shotAfter; ++s)
+            {
+                double gap = pe.shots[s] - drop;
+                shotAfter = (gap >= 0.0) && (gap <= window);
+            }
+            if (!shotAfter) return false;
+            if (d > pe.numDrops - EVENTRING)
+            {
+                double gap = drop - pe.drops[(d - 1) % EVENTRING];
+                gapSum += gap;
+                gapSq += gap * gap;
+            }
+        }
+        double n = EVENTRING - 1;
+        double mean = gapSum / n;
+        double var = gapSq / n - mean * mean;
+        return (mean > 0.0) && (sqrt(var > 0.0 ? var : 0.0) < RHYTHMJITTER * mean);
+    }
+
+public:
+    double window;               // _ggDropShotWindow
+    double threshold;            // _ggSuspectLevel
+
+    CheatWatch() : window(DROPSHOTWINDOW), threshold(SUSPECTLEVEL)
+    {
+        for (int p = 0; p < MAXPLAYERS; ++p) reset(p);
+    }
+
+    void reset(int playerID)
+    {
+        if ((playerID < 0) || (playerID >= MAXPLAYERS)) return;
+        memset(&players[playerID], 0, sizeof(PlayerEvents));
+    }
+
+    void dropped(int playerID, double now)
+    {
+        if ((playerID < 0) || (playerID >= MAXPLAYERS)) return;
+        PlayerEvents &pe = players[playerID];
+        pe.drops[pe.numDrops++ % EVENTRING] = now;
+    }
+
+    void regiven(int playerID, double now)
+    {
+        if ((playerID < 0) || (playerID >= MAXPLAYERS)) return;
+        PlayerEvents &pe = players[playerID];
+        pe.gives[pe.numGives++ % EVENTRING] = now;
+    }
+
+    // the flag drops out of a dying tank just before the die event -
+    // that drop is no cheat, forget it
+    void died(int playerID, double now)
+    {
+        if ((playerID < 0) || (playerID >= MAXPLAYERS)) return;
+        PlayerEvents &pe = players[playerID];
+        double drop = last(pe.drops, pe.numDrops);
+        if ((drop >= 0.0) && (now - drop <= DEATHDROPSLOP)) pe.numDrops--;
+    }
+
+    // returns true the moment a player crosses the suspect threshold
+    // only once - they have to fade to half of it before it can fire again
+    bool shot(int playerID, double now, bool hadFlag)
+    {
+        if ((playerID < 0) || (playerID >= MAXPLAYERS)) return false;
+        PlayerEvents &pe = players[playerID];
+        pe.shots[pe.numShots++ % EVENTRING] = now;
+
+        decay(pe, now);
+        if (pe.flagged && (pe.suspicion < threshold / 2.0)) pe.flagged = false;
+
+        double drop = last(pe.drops, pe.numDrops);
+        if ((drop < 0.0) || (now - drop > window)) return false;
+
+        // shot right after a drop - worse if the flag hadn't come back yet
+        bool regiven = last(pe.gives, pe.numGives) >= drop;
+        pe.suspicion += (hadFlag && regiven) ? 0.1 : 0.25;
+        pe.dropShots++;
+        if (rhythm(pe))
+        {
+            pe.suspicion += 0.5;
+            pe.rhythms++;
+        }
+
+        if ((pe.suspicion >= threshold) && !pe.flagged)
+        {
+            pe.flagged = true;
+            return true;
+        }
+        return false;
+    }
+
+    double confidence(int playerID, double now)
+    {
+        if ((playerID < 0) || (playerID >= MAXPLAYERS)) return 0.0;
+        PlayerEvents &pe = players[playerID];
+        decay(pe, now);
+        return (pe.suspicion > 1.0) ? 1.0 : pe.suspicion;
+    }
+
+    void report(int dest, double now)
+    {
+        typedef multimap<double, int, greater<double> > SuspectsType;
+        SuspectsType suspects;
+        for (int p = 0; p < MAXPLAYERS; ++p)
+        {
+            double c = confidence(p, now);
+            if (c >= 0.05) suspects.insert(pair<double, int>(c, p));
+        }
+        if (!suspects.size())
+        {
+            bz_sendTextMessagef(BZ_SERVER, dest, "No drop-shoot suspects");
+            return;
+        }
+        for (SuspectsType::const_iterator i = suspects.begin(); i != suspects.end(); ++i)
+        {
+            const PlayerEvents &pe = players[i->second];
+            const char *callsign = bz_getPlayerCallsign(i->second);
+            bz_sendTextMessagef(BZ_SERVER, dest, "%3.0f%% %s - %u shots after drops, %u rhythms",
+                                100.0 * i->first, callsign ? callsign : "(gone)",
+                                pe.dropShots, pe.rhythms);
+        }
+    }
+};
+
+// the plugin decides which flag everyone holds, so it knows how fast
+// each of them can legitimately fire.  one token bucket per player,
+// sized and refilled for their current flag
+class ShotRateGuard
+{
+private:
+    struct Bucket
+    {
+        int flag;                // flag# the bucket is sized for
+        float tokens;
+        double last;             // time of last refill
+        unsigned int violations;
+    };
+
+    Bucket players[MAXPLAYERS];
+    float capacity[MAXFLAGS];    // by flag#
+    float refill[MAXFLAGS];      // tokens per second, by flag#
+    unsigned long flagViolations[MAXFLAGS];
+
+public:
+    ShotRateGuard()
+    {
+        memset(players, 0, sizeof(players));
+        memset(flagViolations, 0, sizeof(flagViolations));
+        for (int p = 0; p < MAXPLAYERS; ++p) players[p].flag = -1;
+        for (int f = 0; f < MAXFLAGS; ++f)
+        {
+            capacity[f] = 0.0f;
+            refill[f] = 0.0f;
+        }
+    }
+
+    // from BZDB - when a setting changes, not per shot
+    void configure()
+    {
+        double reloadTime = bz_getBZDBDouble("_reloadTime");
+        if (reloadTime <= 0.0) reloadTime = RELOADTIME;
+        double maxShots = bz_getBZDBInt("_ggMaxShots");
+        if (maxShots < 1.0) maxShots = 1.0;
+        double slack = 1.0 + bz_getBZDBDouble("_ggShotSlack");
+
+        for (int f = 0; (f < MAXFLAGS) && possibleFlags[f].flagName; ++f)
+        {
+            double rate = possibleFlags[f].reloadRate;
+            if (possibleFlags[f].reloadRateVar && bz_BZDBItemExists(possibleFlags[f].reloadRateVar))
+            {
+                rate = bz_getBZDBDouble(possibleFlags[f].reloadRateVar);
+            }
+            if (rate <= 0.0) rate = 1.0;
+            capacity[f] = (float)(maxShots * slack);
+            refill[f] = (float)(maxShots * rate / reloadTime * slack);
+        }
+    }
+
+    void reset(int playerID)
+    {
+        if ((playerID < 0) || (playerID >= MAXPLAYERS)) return;
+        memset(&players[playerID], 0, sizeof(Bucket));
+        players[playerID].flag = -1;
+    }
+
+    // returns false if this shot is over the rate for that flag
+    bool allow(int playerID, int flag, double now)
+    {
+        if ((playerID < 0) || (playerID >= MAXPLAYERS) || (flag < 0) || (flag >= MAXFLAGS)) return true;
+        Bucket &b = players[playerID];
+        if (b.flag != flag)
+        {
+            // new flag - start full
+            b.flag = flag;
+            b.tokens = capacity[flag];
+            b.last = now;
+        }
+        b.tokens += (float)((now - b.last) * refill[flag]);
+        if (b.tokens > capacity[flag]) b.tokens = capacity[flag];
+        b.last = now;
+
+        if (b.tokens < 1.0f)
+        {
+            b.violations++;
+            flagViolations[flag]++;
+            return false;
+        }
+        b.tokens -= 1.0f;
+        return true;
+    }
+
+    void report(int dest)
+    {
+        bool any = false;
+        for (int f = 0; (f < MAXFLAGS) && possibleFlags[f].flagName; ++f)
+        {
+            if (!flagViolations[f]) continue;
+            any = true;
+            bz_sendTextMessagef(BZ_SERVER, dest, "%-3s %lu shots over rate (%.2f/s allowed)",
+                                possibleFlags[f].flagName, flagViolations[f], refill[f]);
+        }
+        for (int p = 0; p < MAXPLAYERS; ++p)
+        {
+            const char *callsign = players[p].violations ? bz_getPlayerCallsign(p) : NULL;
+            if (!callsign) continue;
+            bz_sendTextMessagef(BZ_SERVER, dest, "  %s: %u", callsign, players[p].violations);
+        }
+        if (!any)
+        {
+            bz_sendTextMessagef(BZ_SERVER, dest, "No shots over rate");
+        }
+    }
+};
+
+// where every live player is, bucketed into GRIDCELL squares
+// each cell is a linked list threaded through per-player next/prev, so a
+// position update is O(1) and nearest() only visits rings of cells
+// around the asker until nothing closer can turn up
+class PlayerGrid
+{
+private:
+    int cellsPerSide;
+    float halfWorld;
+    int *cellHead;               // first player in each cell, -1 if empty
+    int next[MAXPLAYERS];
+    int prev[MAXPLAYERS];
+    int cellOf[MAXPLAYERS];      // -1 if not on the grid
+    float posX[MAXPLAYERS];
+    float posY[MAXPLAYERS];
+
+    int cellCoord(float v)
+    {
+        int c = (int)floorf((v + halfWorld) / GRIDCELL);
+        return (c < 0) ? 0 : (c >= cellsPerSide) ? cellsPerSide - 1 : c;
+    }
+
+    void unlink(int id)
+    {
+        int cell = cellOf[id];
+        if (prev[id] >= 0) next[prev[id]] = next[id];
+        else cellHead[cell] = next[id];
+        if (next[id] >= 0) prev[next[id]] = prev[id];
+        cellOf[id] = -1;
+    }
+
+public:
+    PlayerGrid() : cellsPerSide(0), halfWorld(0.0f), cellHead(NULL)
+    {
+        resize(WORLDSIZE);
+    }
+    ~PlayerGrid() { delete[] cellHead; }
+
+    float worldSize() { return 2.0f * halfWorld; }
+
+    // empties the grid
+    void resize(float size)
+    {
+        if (size <= 0.0f) size = WORLDSIZE;
+        halfWorld = size / 2.0f;
+        cellsPerSide = (int)ceilf(size / GRIDCELL);
+        if (cellsPerSide < 1) cellsPerSide = 1;
+        delete[] cellHead;
+        cellHead = new int[cellsPerSide * cellsPerSide];
+        for (int c = 0; c < cellsPerSide * cellsPerSide; ++c) cellHead[c] = -1;
+        for (int p = 0; p < MAXPLAYERS; ++p) cellOf[p] = -1;
+    }
+
+    void update(int id, float x, float y)
+    {
+        if ((id < 0) || (id >= MAXPLAYERS)) return;
+        posX[id] = x;
+        posY[id] = y;
+        int cell = cellCoord(y) * cellsPerSide + cellCoord(x);
+        if (cellOf[id] == cell) return;
+        if (cellOf[id] >= 0) unlink(id);
+        cellOf[id] = cell;
+        prev[id] = -1;
+        next[id] = cellHead[cell];
+        if (next[id] >= 0) prev[next[id]] = id;
+        cellHead[cell] = id;
+    }
+
+    void remove(int id)
+    {
+        if ((id >= 0) && (id < MAXPLAYERS) && (cellOf[id] >= 0)) unlink(id);
+    }
+
+    bool contains(int id)
+    {
+        return (id >= 0) && (id < MAXPLAYERS) && (cellOf[id] >= 0);
+    }
+
+    // nearest other player on the grid in the same arena, -1 if none
+    // dx/dy point from the asker to them
+    int nearest(int id, const int *playerArena, float &dx, float &dy)
+    {
+        if ((id < 0) || (id >= MAXPLAYERS) || (cellOf[id] < 0)) return -1;
+        int cx = cellOf[id] % cellsPerSide;
+        int cy = cellOf[id] / cellsPerSide;
+        int best = -1;
+        float bestDist2 = 0.0f;
+        for (int r = 0; r < cellsPerSide; ++r)
+        {
+            // rings 0..r-1 are done, and nothing in ring r or beyond
+            // can be closer than r-1 whole cells
+            float reach = (r - 1) * GRIDCELL;
+            if ((best >= 0) && (r > 0) && (bestDist2 <= reach * reach)) break;
+            for (int y = cy - r; y <= cy + r; ++y)
+            {
+                if ((y < 0) || (y >= cellsPerSide)) continue;
+                // full rows at the top and bottom of the ring, just the ends in between
+                int step = ((y == cy - r) || (y == cy + r)) ? 1 : 2 * r;
+                for (int x = cx - r; x <= cx + r; x += step)
+                {
+                    if ((x < 0) || (x >= cellsPerSide)) continue;
+                    for (int p = cellHead[y * cellsPerSide + x]; p >= 0; p = next[p])
+                    {
+                        if ((p == id) || (playerArena[p] != playerArena[id])) continue;
+                        float ddx = posX[p] - posX[id];
+                        float ddy = posY[p] - posY[id];
+                        float d2 = ddx * ddx + ddy * ddy;
+                        if ((best < 0) || (d2 < bestDist2))
+                        {
+                            best = p;
+                            bestDist2 = d2;
+                            dx = ddx;
+                            dy = ddy;
+                        }
+                    }
+                }
+            }
+        }
+        return best;
+    }
+};
+
+// live state in POSIX shared memory for dashboards and overlay bots
+// writes are seqlocked (see gunGameShm.h) so readers never block us
+class ShmPublisher
+{
+private:
+    GGShmState *state;
+    string name;
+
+public:
+    ShmPublisher() : state(NULL) {}
+    ~ShmPublisher() { close(); }
+
+    bool isOpen() { return state != NULL; }
+    const string &getName() { return name; }
+    size_t bytes() { return state ? sizeof(GGShmState) : 0; }
+
+    // on failure the name is still remembered, so we don't retry every tick
+    bool open(const char *shmName)
+    {
+        close();
+        if (!shmName || !*shmName) return false;
+        name = shmName;
+
+        int fd = shm_open(shmName, O_CREAT | O_RDWR, 0644);
+        if (fd < 0)
+        {
+            bz_debugMessagef(1, "GunGame: can't create shared memory %s", shmName);
+            return false;
+        }
+        void *mem = MAP_FAILED;
+        if (ftruncate(fd, sizeof(GGShmState)) == 0)
+        {
+            mem = mmap(NULL, sizeof(GGShmState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (mem == MAP_FAILED)
+        {
+            bz_debugMessagef(1, "GunGame: can't map shared memory %s", shmName);
+            shm_unlink(shmName);
+            return false;
+        }
+
+        state = (GGShmState *)mem;
+        state->seq = 0;
+        __sync_synchronize();
+        memset((char *)state + sizeof(state->magic), 0, sizeof(GGShmState) - sizeof(state->magic));
+        state->version = GGSHM_VERSION;
+        state->size = sizeof(GGShmState);
+        __sync_synchronize();
+        state->magic = GGSHM_MAGIC;
+        return true;
+    }
+
+    void close()
+    {
+        if (state)
+        {
+            munmap(state, sizeof(GGShmState));
+            shm_unlink(name.c_str());
+            state = NULL;
+        }
+        name.clear();
+    }
+
+    // seq odd -> write everything -> seq even
+    void publish(FlagManager **arenas, int numArenas, Scoreboard &scoreboard)
+    {
+        if (!state) return;
+        state->seq++;
+        __sync_synchronize();
+
+        state->updated = wallClock();
+        state->numPlayers = 0;
+        for (int a = 0; a < numArenas && a < GGSHM_MAXARENAS; ++a)
+        {
+            if (arenas[a])
+                arenas[a]->publish(*state);
+            else
+                state->arenas[a].active = 0;
+        }
+        scoreboard.publish(*state);
+
+        __sync_synchronize();
+        state->seq++;
+    }
+};
+
+// warm standby - a primary sends its match state to one standby over a
+// Unix socket: a snapshot when the standby connects, then each tick's
+// changes as one batch.  only a background thread touches the socket,
+// so a slow or stuck standby never holds up a tick - its batches queue
+// up and, past REPLQUEUE, are replaced by a fresh snapshot.  the
+// standby keeps what it is sent in a shadow copy, and when the primary
+// goes away it hands that to the plugin (see GunGame::takeOver) so
+// players reconnecting to it pick up where they were
+//
+// a batch is a ReplHeader then records, in host byte order - both ends
+// are on the same host
+struct ReplHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;               // REPL_SNAPSHOT or REPL_DELTA
+    uint32_t seq;
+    uint32_t length;             // bytes of records after the header
+    double time;                 // unix time on the primary
+};
+
+enum ReplBatchType
+{
+    REPL_SNAPSHOT = 1,           // forget everything, what follows is all of it
+    REPL_DELTA
+};
+
+enum ReplRecord
+{
+    RR_ARENA = 1,                // u8 arena, u8 active, u8 gameOn, u8 numLevels, u16 numPlayers, double matchStart
+    RR_PLAYER,                   // u8 playerID, s8 arena, s8 flag, s8 level, s32 wins
+    RR_CALLSIGN,                 // u8 playerID, u8 length, callsign - a new player in that slot
+    RR_PART,                     // u8 playerID
+    RR_WINNER                    // s32 wins, u8 length, callsign - snapshots only
+};
+
+class Replicator
+{
+public:
+    enum Role { OFF, PRIMARY, STANDBY };
+
+    struct ShadowPlayer
+    {
+        string callsign;
+        int arena;
+        int flag;
+        int level;
+        int wins;
+        bool present;
+    };
+
+    struct ShadowArena
+    {
+        bool active;
+        bool gameOn;
+        int numLevels;
+        int numPlayers;
+        double matchStart;
+    };
+
+private:
+    Role role;
+    string path;
+    int listenFd;                // primary, the thread accepts on it
+    dev_t boundDev;              // primary: the socket file it bound, so stop
+    ino_t boundIno;              // removes that one and nothing else
+    pthread_t thread;
+    bool threadRunning;
+
+    // shared with the thread, under mutex
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    bool stopping;
+    bool connected;
+    bool wantSnapshot;           // primary: a standby just connected
+    bool primaryLost;            // standby: the primary went away after a snapshot
+    list<string> outbox;         // primary: batches for the thread to send
+    list<string> inbox;          // standby: whole batches for the tick to apply
+    unsigned long batchesSent;
+    unsigned long bytesSent;
+    unsigned long connects;
+
+    // primary, tick side - what the standby has been sent
+    GGShmState *current;
+    GGShmPlayer sent[MAXPLAYERS];
+    bool sentPresent[MAXPLAYERS];
+    GGShmArena sentArenas[MAXARENAS];
+    uint32_t seq;
+    unsigned long snapshots;
+    unsigned long resyncs;
+
+    // standby, tick side
+    bool haveSnapshot;
+    bool tookOver;
+    uint32_t lastSeq;
+    double lastTime;
+    unsigned long batchesApplied;
+    unsigned long bytesApplied;
+    unsigned long badBatches;
+
+    // largest batch a primary sends: a snapshot with every record in it.
+    // deltas never carry more than that
+    static size_t maxBatch()
+    {
+        return MAXARENAS * 15 +                            // RR_ARENA
+               MAXPLAYERS * (3 + GGSHM_CALLSIGNLEN + 9) +  // RR_CALLSIGN, RR_PLAYER
+               REPLMAXWINNERS * (6 + 255);                 // RR_WINNER
+    }
+
+    static void put8(string &out, int v) { out += (char)(uint8_t)v; }
+    static void put16(string &out, int v) { uint16_t x = v; out.append((const char *)&x, sizeof(x)); }
+    static void put32(string &out, int v) { int32_t x = v; out.append((const char *)&x, sizeof(x)); }
+    static void putDouble(string &out, double v) { out.append((const char *)&v, sizeof(v)); }
+    static void putName(string &out, const char *name, size_t maxLen)
+    {
+        size_t len = strnlen(name, maxLen < 255 ? maxLen : 255);
+        put8(out, len);
+        out.append(name, len);
+    }
+
+    // reads off the front of a record buffer, false once it runs short
+    struct Cursor
+    {
+        const char *p;
+        const char *end;
+
+        bool take(void *v, size_t n)
+        {
+            if ((size_t)(end - p) < n) return false;
+            memcpy(v, p, n);
+            p += n;
+            return true;
+        }
+        bool get8(int &v) { uint8_t x; if (!take(&x, 1)) return false; v = x; return true; }
+        bool gets8(int &v) { int8_t x; if (!take(&x, 1)) return false; v = x; return true; }
+        bool get16(int &v) { uint16_t x; if (!take(&x, 2)) return false; v = x; return true; }
+        bool get32(int &v) { int32_t x; if (!take(&x, 4)) return false; v = x; return true; }
+        bool getDouble(double &v) { return take(&v, sizeof(v)); }
+        bool getName(string &s)
+        {
+            int len;
+            if (!get8(len) || ((end - p) < len)) return false;
+            s.assign(p, len);
+            p += len;
+            return true;
+        }
+    };
+
+    static bool sameArena(const GGShmArena &a, const GGShmArena &b)
+    {
+        return (a.active == b.active) && (a.gameOn == b.gameOn) && (a.numLevels == b.numLevels) &&
+               (a.numPlayers == b.numPlayers) && (a.matchStart == b.matchStart);
+    }
+
+    static bool samePlayer(const GGShmPlayer &a, const GGShmPlayer &b)
+    {
+        return (a.arena == b.arena) && (a.flag == b.flag) && (a.level == b.level) && (a.wins == b.wins);
+    }
+
+    // records for whatever differs from what was sent - everything, for
+    // a snapshot
+    void diff(FlagManager **arenas, Scoreboard &scoreboard, bool full, string &out)
+    {
+        memset(current, 0, sizeof(GGShmState));
+        for (int a = 0; a < MAXARENAS && a < GGSHM_MAXARENAS; ++a)
+        {
+            if (arenas[a]) arenas[a]->publish(*current);
+        }
+
+        for (int a = 0; a < MAXARENAS && a < GGSHM_MAXARENAS; ++a)
+        {
+            const GGShmArena &now = current->arenas[a];
+            if (!full && sameArena(now, sentArenas[a])) continue;
+            put8(out, RR_ARENA);
+            put8(out, a);
+            put8(out, now.active);
+            put8(out, now.gameOn);
+            put8(out, now.numLevels);
+            put16(out, now.numPlayers);
+            putDouble(out, now.matchStart);
+            sentArenas[a] = now;
+        }
+
+        const GGShmPlayer *byID[MAXPLAYERS];
+        memset(byID, 0, sizeof(byID));
+        for (int i = 0; i < current->numPlayers; ++i)
+        {
+            int playerID = current->players[i].playerID;
+            if ((playerID >= 0) && (playerID < MAXPLAYERS)) byID[playerID] = &current->players[i];
+        }
+        for (int p = 0; p < MAXPLAYERS; ++p)
+        {
+            const GGShmPlayer *now = byID[p];
+            if (!now)
+            {
+                if (sentPresent[p] && !full)
+                {
+                    put8(out, RR_PART);
+                    put8(out, p);
+                }
+                sentPresent[p] = false;
+                continue;
+            }
+            bool known = sentPresent[p] && !full;
+            if (!known || strncmp(now->callsign, sent[p].callsign, GGSHM_CALLSIGNLEN))
+            {
+                put8(out, RR_CALLSIGN);
+                put8(out, p);
+                putName(out, now->callsign, GGSHM_CALLSIGNLEN);
+                known = false;
+            }
+            if (!known || !samePlayer(*now, sent[p]))
+            {
+                put8(out, RR_PLAYER);
+                put8(out, p);
+                put8(out, now->arena);
+                put8(out, now->flag);
+                put8(out, now->level);
+                put32(out, now->wins);
+            }
+            sent[p] = *now;
+            sentPresent[p] = true;
+        }
+
+        if (full)
+        {
+            const Scoreboard::LeaderboardType &ranking = scoreboard.ranking();
+            int n = 0;
+            for (Scoreboard::LeaderboardType::const_iterator i = ranking.begin();
+                 (i != ranking.end()) && (n++ < REPLMAXWINNERS); ++i)
+            {
+                put8(out, RR_WINNER);
+                put32(out, i->first);
+                putName(out, i->second, 255);
+            }
+        }
+    }
+
+    bool apply(const string &batch)
+    {
+        ReplHeader h;
+        memcpy(&h, batch.data(), sizeof(h));
+        if (h.type == REPL_SNAPSHOT)
+        {
+            for (int p = 0; p < MAXPLAYERS; ++p) players[p].present = false;
+            for (int a = 0; a < MAXARENAS; ++a) shadowArenas[a].active = false;
+            winners.clear();
+            haveSnapshot = true;
+        }
+        else if (!haveSnapshot)
+        {
+            // left over from before our snapshot
+            return true;
+        }
+
+        Cursor c;
+        c.p = batch.data() + sizeof(h);
+        c.end = batch.data() + batch.size();
+        while (c.p < c.end)
+        {
+            int kind, id, v;
+            if (!c.get8(kind)) return false;
+            if (kind == RR_ARENA)
+            {
+                int active, on, levels, numPlayers;
+                double start;
+                if (!c.get8(id) || !c.get8(active) || !c.get8(on) || !c.get8(levels) ||
+                    !c.get16(numPlayers) || !c.getDouble(start) || (id >= MAXARENAS)) return false;
+                ShadowArena &a = shadowArenas[id];
+                a.active = active;
+                a.gameOn = on;
+                a.numLevels = levels;
+                a.numPlayers = numPlayers;
+                a.matchStart = start;
+            }
+            else if (kind == RR_PLAYER)
+            {
+                ShadowPlayer s;
+                if (!c.get8(id) || !c.gets8(s.arena) || !c.gets8(s.flag) || !c.gets8(s.level) || !c.get32(s.wins)) return false;
+                if ((s.arena < 0) || (s.arena >= MAXARENAS) || (s.flag >= MAXFLAGS)) return false;
+                ShadowPlayer &p = players[id];
+                p.arena = s.arena;
+                p.flag = s.flag;
+                p.level = s.level;
+                p.wins = s.wins;
+                p.present = true;
+                if (p.wins > 0) winners[p.callsign] = p.wins;
+            }
+            else if (kind == RR_CALLSIGN)
+            {
+                if (!c.get8(id) || !c.getName(players[id].callsign)) return false;
+            }
+            else if (kind == RR_PART)
+            {
+                if (!c.get8(id)) return false;
+                players[id].present = false;
+            }
+            else if (kind == RR_WINNER)
+            {
+                string callsign;
+                if (!c.get32(v) || !c.getName(callsign)) return false;
+                winners[callsign] = v;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        lastSeq = h.seq;
+        lastTime = h.time;
+        return true;
+    }
+
+    static bool writeAll(int fd, const string &data)
+    {
+        size_t done = 0;
+        while (done < data.size())
+        {
+            ssize_t n = ::send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            done += n;
+        }
+        return true;
+    }
+
+    bool shouldStop()
+    {
+        pthread_mutex_lock(&mutex);
+        bool stop = stopping;
+        pthread_mutex_unlock(&mutex);
+        return stop;
+    }
+
+    // accept one standby at a time and send it whatever the tick queued
+    void runPrimary()
+    {
+        int fd = -1;
+        while (!shouldStop())
+        {
+            if (fd < 0)
+            {
+                struct pollfd pfd = { listenFd, POLLIN, 0 };
+                if ((poll(&pfd, 1, 100) <= 0) || ((fd = accept(listenFd, NULL, NULL)) < 0)) continue;
+                pthread_mutex_lock(&mutex);
+                // deltas queued before this standby's snapshot mean nothing to it
+                outbox.clear();
+                connected = true;
+                wantSnapshot = true;
+                connects++;
+                pthread_mutex_unlock(&mutex);
+            }
+
+            string batch;
+            pthread_mutex_lock(&mutex);
+            if (outbox.empty() && !stopping)
+            {
+                struct timespec until;
+                clock_gettime(CLOCK_REALTIME, &until);
+                until.tv_nsec += 100000000;
+                if (until.tv_nsec >= 1000000000)
+                {
+                    until.tv_sec++;
+                    until.tv_nsec -= 1000000000;
+                }
+                pthread_cond_timedwait(&wake, &mutex, &until);
+            }
+            if (!outbox.empty())
+            {
+                batch.swap(outbox.front());
+                outbox.pop_front();
+            }
+            pthread_mutex_unlock(&mutex);
+
+            bool ok;
+            if (batch.size())
+            {
+                ok = writeAll(fd, batch);
+            }
+            else
+            {
+                // idle - the standby never talks, so readable means it hung up
+                struct pollfd pfd = { fd, POLLIN, 0 };
+                char c;
+                ok = (poll(&pfd, 1, 0) <= 0) || (recv(fd, &c, 1, MSG_DONTWAIT) > 0);
+            }
+            pthread_mutex_lock(&mutex);
+            if (ok && batch.size())
+            {
+                batchesSent++;
+                bytesSent += batch.size();
+            }
+            if (!ok)
+            {
+                connected = false;
+                outbox.clear();
+            }
+            pthread_mutex_unlock(&mutex);
+            if (!ok)
+            {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        if (fd >= 0) ::close(fd);
+    }
+
+    // keep trying the primary until it answers, then read whole batches
+    // into the inbox.  losing it after a snapshot ends replication here
+    void runStandby()
+    {
+        int fd = -1;
+        bool gotSnapshot = false;
+        string buf;
+        char chunk[65536];
+        while (!shouldStop())
+        {
+            if (fd < 0)
+            {
+                fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                struct sockaddr_un addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sun_family = AF_UNIX;
+                strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+                if ((fd < 0) || (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0))
+                {
+                    if (fd >= 0) ::close(fd);
+                    fd = -1;
+                    poll(NULL, 0, 200);
+                    continue;
+                }
+                buf.clear();
+                pthread_mutex_lock(&mutex);
+                connected = true;
+                connects++;
+                pthread_mutex_unlock(&mutex);
+            }
+
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            if (poll(&pfd, 1, 100) <= 0) continue;
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if ((n < 0) && (errno == EINTR)) continue;
+            bool lost = (n <= 0);
+            if (n > 0) buf.append(chunk, n);
+
+            size_t used = 0;
+            while (!lost && (buf.size() - used >= sizeof(ReplHeader)))
+            {
+                ReplHeader h;
+                memcpy(&h, buf.data() + used, sizeof(h));
+                if ((h.magic != REPLMAGIC) || (h.version != REPLVERSION) || (h.length > maxBatch()))
+                {
+                    // not something we can follow, or longer than any batch the
+                    // primary sends - treat it like the primary going away
+                    lost = true;
+                    break;
+                }
+                if (buf.size() - used < sizeof(h) + h.length) break;
+                if (h.type == REPL_SNAPSHOT) gotSnapshot = true;
+                pthread_mutex_lock(&mutex);
+                inbox.push_back(buf.substr(used, sizeof(h) + h.length));
+                pthread_mutex_unlock(&mutex);
+                used += sizeof(h) + h.length;
+            }
+            buf.erase(0, used);
+
+            if (lost)
+            {
+                ::close(fd);
+                fd = -1;
+                pthread_mutex_lock(&mutex);
+                connected = false;
+                if (gotSnapshot) primaryLost = true;
+                pthread_mutex_unlock(&mutex);
+                if (gotSnapshot) break;
+            }
+        }
+        if (fd >= 0) ::close(fd);
+    }
+
+    static void *threadMain(void *arg)
+    {
+        Replicator *r = (Replicator *)arg;
+        if (r->role == PRIMARY)
+            r->runPrimary();
+        else
+            r->runStandby();
+        return NULL;
+    }
+
+public:
+    ShadowPlayer players[MAXPLAYERS];    // standby: the primary's players, by its player IDs
+    ShadowArena shadowArenas[MAXARENAS];
+    map<string, int> winners;            // standby: wins by callsign
+
+    Replicator()
+         : role(OFF),
+           listenFd(-1),
+           boundDev(0),
+           boundIno(0),
+           threadRunning(false),
+           current(new GGShmState)
+    {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&wake, NULL);
+        reset();
+    }
+
+    ~Replicator()
+    {
+        stop();
+        delete current;
+        pthread_cond_destroy(&wake);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    // from BZDB, whenever a setting changes - a change of path or role starts over
+    void configure(const char *socketPath, bool standby)
+    {
+        Role want = (socketPath && *socketPath) ? (standby ? STANDBY : PRIMARY) : OFF;
+        if ((want == role) && (path == (socketPath ? socketPath : ""))) return;
+        stop();
+        role = want;
+        path = socketPath ? socketPath : "";
+        if (role == OFF) return;
+
+        struct sockaddr_un addr;
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            bz_debugMessagef(1, "GunGame: replica socket path too long: %s", path.c_str());
+            return;
+        }
+        if (role == PRIMARY)
+        {
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            // a socket left behind by a crashed primary - never anything else
+            struct stat st;
+            if (lstat(path.c_str(), &st) == 0)
+            {
+                if (!S_ISSOCK(st.st_mode))
+                {
+                    bz_debugMessagef(1, "GunGame: replica socket path %s is not a socket - leaving it alone", path.c_str());
+                    return;
+                }
+                unlink(path.c_str());
+            }
+            listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if ((listenFd < 0) || (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+                (listen(listenFd, 1) != 0) || (lstat(path.c_str(), &st) != 0))
+            {
+                bz_debugMessagef(1, "GunGame: can't listen for a standby on %s", path.c_str());
+                if (listenFd >= 0) ::close(listenFd);
+                listenFd = -1;
+                return;
+            }
+            boundDev = st.st_dev;
+            boundIno = st.st_ino;
+        }
+        stopping = false;
+        threadRunning = (pthread_create(&thread, NULL, threadMain, this) == 0);
+        if (!threadRunning) bz_debugMessagef(1, "GunGame: no replication thread");
+    }
+
+    // the path is remembered, so a failed setup isn't retried every tick
+    void stop()
+    {
+        if (threadRunning)
+        {
+            pthread_mutex_lock(&mutex);
+            stopping = true;
+            pthread_cond_signal(&wake);
+            pthread_mutex_unlock(&mutex);
+            pthread_join(thread, NULL);
+            threadRunning = false;
+        }
+        if (listenFd >= 0)
+        {
+            // unless someone has since put their own file there
+            struct stat st;
+            ::close(listenFd);
+            if ((lstat(path.c_str(), &st) == 0) && S_ISSOCK(st.st_mode) &&
+                (st.st_dev == boundDev) && (st.st_ino == boundIno))
+            {
+                unlink(path.c_str());
+            }
+            listenFd = -1;
+        }
+        reset();
+    }
+
+    void reset()
+    {
+        stopping = false;
+        connected = false;
+        wantSnapshot = false;
+        primaryLost = false;
+        outbox.clear();
+        inbox.clear();
+        batchesSent = bytesSent = connects = 0;
+        memset(sentPresent, 0, sizeof(sentPresent));
+        memset(sentArenas, 0, sizeof(sentArenas));
+        seq = 0;
+        snapshots = resyncs = 0;
+        haveSnapshot = tookOver = false;
+        lastSeq = 0;
+        lastTime = 0.0;
+        batchesApplied = bytesApplied = badBatches = 0;
+        for (int p = 0; p < MAXPLAYERS; ++p) players[p].present = false;
+        memset(shadowArenas, 0, sizeof(shadowArenas));
+        winners.clear();
+    }
+
+    // primary, once a tick: queue this tick's changes as one batch (if
+    // the match state changed), or a snapshot for a standby that needs one
+    void send(FlagManager **arenas, Scoreboard &scoreboard, bool changed)
+    {
+        if (role != PRIMARY) return;
+        pthread_mutex_lock(&mutex);
+        bool live = connected;
+        bool full = wantSnapshot;
+        if (outbox.size() >= REPLQUEUE)
+        {
+            outbox.clear();
+            full = true;
+            resyncs++;
+        }
+        wantSnapshot = false;
+        pthread_mutex_unlock(&mutex);
+        if (!live || (!full && !changed)) return;
+
+        string batch(sizeof(ReplHeader), '\0');
+        diff(arenas, scoreboard, full, batch);
+        if (!full && (batch.size() == sizeof(ReplHeader))) return;
+
+        ReplHeader h;
+        memset(&h, 0, sizeof(h));
+        h.magic = REPLMAGIC;
+        h.version = REPLVERSION;
+        h.type = full ? REPL_SNAPSHOT : REPL_DELTA;
+        h.seq = ++seq;
+        h.length = batch.size() - sizeof(h);
+        h.time = wallClock();
+        memcpy(&batch[0], &h, sizeof(h));
+        if (full) snapshots++;
+
+        pthread_mutex_lock(&mutex);
+        outbox.push_back(string());
+        outbox.back().swap(batch);
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    // standby, once a tick: apply what arrived to the shadow.  true once
+    // the primary is gone and the shadow should be taken over
+    bool receive()
+    {
+        if ((role != STANDBY) || tookOver) return false;
+        list<string> batches;
+        pthread_mutex_lock(&mutex);
+        batches.swap(inbox);
+        bool lost = primaryLost;
+        pthread_mutex_unlock(&mutex);
+
+        for (list<string>::const_iterator b = batches.begin(); b != batches.end(); ++b)
+        {
+            if (apply(*b))
+            {
+                batchesApplied++;
+                bytesApplied += b->size();
+            }
+            else
+            {
+                // a record we can't read - the rest of the batch is lost, so
+                // this shadow can't be trusted until the next snapshot
+                badBatches++;
+                haveSnapshot = false;
+            }
+        }
+        if (lost && haveSnapshot)
+        {
+            // the thread stops following once it has lost the primary
+            if (threadRunning) pthread_join(thread, NULL);
+            threadRunning = false;
+            tookOver = true;
+            return true;
+        }
+        return false;
+    }
+
+    size_t bytes()
     {
-        // new game -- pass out flags to anyone spawned
-        const char *firstFlagName = possibleFlags[firstFlag].flagName;
-#ifdef PLAYSOUNDS
-        bz_sendPlayCustomLocalSound(BZ_ALLUSERS, "gungame/gungame_start");
-#endif
-            
-        bz_BasePlayerRecord *pr = NULL;
-        for (AssignedFlagsType::iterator i = assignedFlags.begin(); i != assignedFlags.end(); ++i)
+        size_t n = sizeof(GGShmState);
+        pthread_mutex_lock(&mutex);
+        for (list<string>::const_iterator i = outbox.begin(); i != outbox.end(); ++i) n += NODEBYTES + i->capacity();
+        for (list<string>::const_iterator i = inbox.begin(); i != inbox.end(); ++i) n += NODEBYTES + i->capacity();
+        pthread_mutex_unlock(&mutex);
+        for (map<string, int>::const_iterator i = winners.begin(); i != winners.end(); ++i)
         {
-            int playerID = i->first;
-            i->second = firstFlag;
-            bz_setPlayerWins(playerID, 1);
-            bz_setPlayerLosses(playerID, 0);
-            bz_setPlayerTKs(playerID, 0);
-            replaceFlagIfAlive(playerID, firstFlagName, "game begin", true);
+            n += NODEBYTES + sizeof(string) + i->first.capacity() + sizeof(int);
         }
+        return n;
     }
 
-    void endGG()
+    void report(int dest)
     {
-        for (AssignedFlagsType::iterator i = assignedFlags.begin(); i != assignedFlags.end(); ++i)
+        pthread_mutex_lock(&mutex);
+        bool live = connected;
+        unsigned long sentBatches = batchesSent, sentBytes = bytesSent, numConnects = connects;
+        size_t queued = outbox.size();
+        pthread_mutex_unlock(&mutex);
+
+        if (role == OFF)
         {
-            // reset flag and scores
-            int playerID = i->first;
-            i->second = -1;
-            bz_setPlayerWins(playerID, 0);
-            bz_setPlayerLosses(playerID, 0);
-            bz_setPlayerTKs(playerID, 0);
-            
-            replaceFlagIfAlive(playerID, NULL, "game end");
+            bz_sendTextMessagef(BZ_SERVER, dest, "replication: off (_ggReplicaSocket)");
+        }
+        else if (role == PRIMARY)
+        {
+            bz_sendTextMessagef(BZ_SERVER, dest, "replication: primary on %s, standby %s (%lu connects)",
+                                path.c_str(), live ? "connected" : "not connected", numConnects);
+            bz_sendTextMessagef(BZ_SERVER, dest, "  %lu batches, %lu KB sent, %lu snapshots, %lu resyncs, %d queued",
+                                sentBatches, sentBytes / 1024, snapshots, resyncs, (int)queued);
+        }
+        else
+        {
+            int numPlayers = 0, numArenas = 0;
+            for (int p = 0; p < MAXPLAYERS; ++p) if (players[p].present) numPlayers++;
+            for (int a = 0; a < MAXARENAS; ++a) if (shadowArenas[a].active) numArenas++;
+            bz_sendTextMessagef(BZ_SERVER, dest, "replication: standby of %s, %s",
+                                path.c_str(), tookOver ? "took over" : (live ? "following" : "waiting for the primary"));
+            bz_sendTextMessagef(BZ_SERVER, dest, "  %lu batches, %lu KB applied, %lu unreadable, last #%u %.1fs ago",
+                                batchesApplied, bytesApplied / 1024, badBatches, lastSeq,
+                                lastTime > 0.0 ? wallClock() - lastTime : 0.0);
+            bz_sendTextMessagef(BZ_SERVER, dest, "  shadow: %d players in %d arenas, %d winners",
+                                numPlayers, numArenas, (int)winners.size());
         }
     }
+};
 
-    void addWinner(const char *callsign)
+// deferred plugin work, run from the tick handler
+// a task does one small unit of work per runSlice() and returns true
+// while it has more to do this tick, false once it is caught up
+class TickTask
+{
+public:
+    virtual ~TickTask() {}
+    virtual bool runSlice(double now) = 0;
+    virtual size_t backlog() = 0;
+    virtual const char *name() = 0;
+};
+
+// runs tasks in priority order (lowest first) until the tick's
+// microsecond budget is used up. whatever is left carries over
+class TickScheduler
+{
+private:
+    struct Entry
     {
-        WinnersListType::iterator i = winnersList.find(callsign);
-        if (i == winnersList.end())
+        Entry(int p=0, TickTask *t=NULL) : priority(p), task(t) {}
+        int priority;
+        TickTask *task;
+    };
+    typedef list<Entry> TaskListType;
+    TaskListType tasks;
+
+    static double nowUsec()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+    }
+
+public:
+    unsigned long ticks;         // ticks run
+    unsigned long deferredTicks; // ticks that ran out of budget with work left
+    unsigned long overruns;      // ticks that went over budget
+    double worstUsec;            // longest tick seen
+
+    TickScheduler() : ticks(0), deferredTicks(0), overruns(0), worstUsec(0.0) {}
+
+    void add(TickTask *task, int priority)
+    {
+        TaskListType::iterator i = tasks.begin();
+        while ((i != tasks.end()) && (i->priority <= priority)) ++i;
+        tasks.insert(i, Entry(priority, task));
+    }
+
+    void remove(TickTask *task)
+    {
+        for (TaskListType::iterator i = tasks.begin(); i != tasks.end(); ++i)
         {
-            // first time winning
-            winnersList.insert(pair<const char *, int>(strdup(callsign),1));
+            if (i->task == task)
+            {
+                tasks.erase(i);
+                return;
+            }
         }
-        else
+    }
+
+    void run(double now, double budgetUsec)
+    {
+        double start = nowUsec();
+        double used = 0.0;
+        bool outOfTime = false;
+        for (TaskListType::iterator i = tasks.begin(); (i != tasks.end()) && !outOfTime; ++i)
+        {
+            while (i->task->runSlice(now))
+            {
+                used = nowUsec() - start;
+                if (used >= budgetUsec)
+                {
+                    outOfTime = true;
+                    break;
+                }
+            }
+        }
+        used = nowUsec() - start;
+
+        ticks++;
+        if (outOfTime) deferredTicks++;
+        if (used > worstUsec) worstUsec = used;
+        if (used > budgetUsec)
         {
-            i->second += 1;
+            overruns++;
+            bz_debugMessagef(2, "GunGame: tick took %.0fus (budget %.0fus), backlog %u",
+                             used, budgetUsec, (unsigned int)backlog());
         }
     }
 
-    void listFlags(int dest=BZ_ALLUSERS)
+    size_t backlog()
     {
-        for (FlagLevelsType::const_iterator it = flagLevels.begin();
-             it != flagLevels.end();
-             ++it)
+        size_t n = 0;
+        for (TaskListType::iterator i = tasks.begin(); i != tasks.end(); ++i)
         {
-            bz_sendTextMessagef(BZ_SERVER, dest, "Flag %3d: %s", it->second, possibleFlags[it->first].flagName);
+            n += i->task->backlog();
         }
+        return n;
     }
 
-    void announceWinners(int dest)
+    void report(int dest)
     {
-        if (!winnersList.size())
+        bz_sendTextMessagef(BZ_SERVER, dest, "ticks: %lu, out of budget: %lu, over budget: %lu, worst: %.0fus",
+                            ticks, deferredTicks, overruns, worstUsec);
+        for (TaskListType::iterator i = tasks.begin(); i != tasks.end(); ++i)
         {
-            bz_sendTextMessagef(BZ_SERVER, dest, "No wins yet...");
+            bz_sendTextMessagef(BZ_SERVER, dest, "  %d %s: %u queued",
+                                i->priority, i->task->name(), (unsigned int)i->task->backlog());
         }
-        else
+    }
+};
+
+class GunGame : public bz_Plugin, public bz_CustomSlashCommandHandler
+{
+private:
+    // each arena is an independent match with its own ladder
+    // players are routed to theirs through playerArena
+    FlagManager *arenas[MAXARENAS];
+    int playerArena[MAXPLAYERS];     // arena# by player ID (-1 if none)
+    int numArenasOn;                 // arenas with a game in progress
+    Scoreboard scoreboard;
+    int debuggerID;
+    const char *debuggerIP;
+    bool savedHideFlagsOnRadar;
+    bool savedShotMismatch;
+    TickScheduler scheduler;
+    CheatWatch cheatWatch;
+    ShotRateGuard shotGuard;
+    double lastCommand[MAXPLAYERS];  // when each player last used flags/winners/leaders
+    bool cooldownWarned[MAXPLAYERS];
+
+    // true if the player may have another flags/winners/leaders answer yet
+    bool commandAllowed(int playerID)
+    {
+        if ((playerID < 0) || (playerID >= MAXPLAYERS)) return true;
+        double now = bz_getCurrentTime();
+        double cooldown = bz_getBZDBDouble("_ggCommandCooldown");
+        if (now - lastCommand[playerID] < cooldown)
         {
-            bz_sendTextMessagef(BZ_SERVER, dest, "-= S C O R E B O A R D =-");
-            // sort winners by win count
-            typedef multimap<int, const char *, greater<int> > LeaderboardType;
-            LeaderboardType Leaderboard; 
-            Leaderboard.clear();
-            for (WinnersListType::const_iterator i = winnersList.begin(); i != winnersList.end(); ++i)
-            {
-                Leaderboard.insert(pair<int, const char *>(i->second, i->first));
-            }
-            for (LeaderboardType::const_iterator j = Leaderboard.begin(); j != Leaderboard.end(); ++j)
+            if (!cooldownWarned[playerID])
             {
-                bz_sendTextMessagef(BZ_SERVER, dest, "%d win%s - %s",
-                                    j->first, 
-                                    (j->first > 1) ? "s":"",
-                                    j->second);
+                bz_sendTextMessagef(BZ_SERVER, playerID, "One command every %.0f seconds, please", cooldown);
+                cooldownWarned[playerID] = true;
             }
+            return false;
         }
+        lastCommand[playerID] = now;
+        cooldownWarned[playerID] = false;
+        return true;
     }
 
-    void announceLeaders(int dest)
+    // how often one flag took out several players in a tick, over all arenas
+    void reportMultiKills(int dest)
     {
-        int maxFlag = -1;
-        list<int> quasiWinners;
-        for (AssignedFlagsType::const_iterator i = assignedFlags.begin(); i != assignedFlags.end(); ++i)
+        unsigned long counts[MULTIKILLMAX + 1];
+        unsigned long byFlag[MAXFLAGS];
+        memset(counts, 0, sizeof(counts));
+        memset(byFlag, 0, sizeof(byFlag));
+        for (int a = 0; a < MAXARENAS; ++a)
         {
-            int playerID = i->first;
-            int flag = i->second;
-            if (flag > maxFlag)
+            if (!arenas[a]) continue;
+            for (int k = 0; k <= MULTIKILLMAX; ++k) counts[k] += arenas[a]->multiKills[k];
+            for (int f = 0; f < MAXFLAGS; ++f) byFlag[f] += arenas[a]->multiKillsByFlag[f];
+        }
+        unsigned long advances = 0, multi = 0;
+        for (int k = 1; k <= MULTIKILLMAX; ++k)
+        {
+            advances += counts[k];
+            if (k > 1) multi += counts[k];
+        }
+        bz_sendTextMessagef(BZ_SERVER, dest, "advances: %lu, %lu of them multi-kills (%.1f%%)",
+                            advances, multi, advances ? 100.0 * multi / advances : 0.0);
+        if (!multi) return;
+        string line = "kills at once:";
+        char item[32];
+        for (int k = 2; k <= MULTIKILLMAX; ++k)
+        {
+            snprintf(item, sizeof(item), "  %d%s: %lu", k, (k == MULTIKILLMAX) ? "+" : "", counts[k]);
+            line += item;
+        }
+        bz_sendTextMessagef(BZ_SERVER, dest, "%s", line.c_str());
+        line = "by flag:";
+        for (int f = 0; (f < MAXFLAGS) && possibleFlags[f].flagName; ++f)
+        {
+            if (!byFlag[f]) continue;
+            snprintf(item, sizeof(item), "  %s %lu", possibleFlags[f].flagName, byFlag[f]);
+            line += item;
+        }
+        bz_sendTextMessagef(BZ_SERVER, dest, "%s", line.c_str());
+    }
+
+    // what the plugin holds - growing parts first, then the fixed tables
+    void reportMemory(int dest)
+    {
+        size_t heap = scoreboard.bytes() + replicator.bytes();
+        for (int a = 0; a < MAXARENAS; ++a)
+        {
+            if (arenas[a]) heap += arenas[a]->bytes();
+        }
+        size_t fixed = sizeof(*this);
+        bz_sendTextMessagef(BZ_SERVER, dest, "GunGame memory: ~%d KB heap, %d KB fixed, %d KB mapped - server resident %ld KB",
+                            (int)(heap / 1024), (int)(fixed / 1024),
+                            (int)((scoreboard.global.bytes() + scoreboard.spillBytes() + shmPublisher.bytes()) / 1024),
+                            residentKB());
+        scoreboard.report(dest);
+        for (int a = 0; a < MAXARENAS; ++a)
+        {
+            if (!arenas[a]) continue;
+            bz_sendTextMessagef(BZ_SERVER, dest, "arena %d: %d players, %d pending gives, ~%d KB",
+                                a + 1, (int)arenas[a]->rosterSize(), (int)arenas[a]->numDelayedFlags(),
+                                (int)(arenas[a]->bytes() / 1024));
+        }
+        bz_sendTextMessagef(BZ_SERVER, dest, "fixed: cheat watch %d KB, shot guard %d KB, grid %d KB, trace ring %d KB, give latency %d KB",
+                            (int)(sizeof(cheatWatch) / 1024), (int)(sizeof(shotGuard) / 1024),
+                            (int)(sizeof(grid) / 1024), (int)(sizeof(trace) / 1024), (int)(sizeof(gives) / 1024));
+    }
+
+    // retry flag gives that failed - players are unarmed until these land
+    class DelayedGiveTask : public TickTask
+    {
+    private:
+        GunGame *gg;
+        int arena;
+        int nextPlayer;
+    public:
+        DelayedGiveTask(GunGame *g) : gg(g), arena(0), nextPlayer(0) {}
+        virtual const char *name() { return "flag gives"; }
+        virtual bool runSlice(double now)
+        {
+            for (; arena < MAXARENAS; ++arena, nextPlayer = 0)
             {
-                quasiWinners.clear();
-                quasiWinners.push_back(playerID);
-                maxFlag = flag;
+                if (!gg->arenas[arena]) continue;
+                int playerID = gg->arenas[arena]->giveNextDelayedFlag(nextPlayer, now);
+                if (playerID >= 0)
+                {
+                    nextPlayer = playerID + 1;
+                    return true;
+                }
             }
-            else if (flag == maxFlag)
+            arena = 0;
+            return false;
+        }
+        virtual size_t backlog()
+        {
+            size_t n = 0;
+            for (int a = 0; a < MAXARENAS; ++a)
             {
-                quasiWinners.push_back(playerID);
+                if (gg->arenas[a]) n += gg->arenas[a]->numDelayedFlags();
             }
+            return n;
         }
-    
-        // announce "quasi winners"
-        if (maxFlag > firstFlag)
+    };
+
+    // apply batched joins/parts once an arena's window closes
+    class RosterTask : public TickTask
+    {
+    private:
+        GunGame *gg;
+        int arena;
+    public:
+        RosterTask(GunGame *g) : gg(g), arena(0) {}
+        virtual const char *name() { return "join/part"; }
+        virtual bool runSlice(double now)
         {
-            string qwinners = "";
-            for(list<int>::const_iterator i = quasiWinners.begin();
-                i != quasiWinners.end(); 
-                ++i)
+            for (; arena < MAXARENAS; ++arena)
             {
-                qwinners += bz_getPlayerCallsign(*i);
-                qwinners += ", ";
+                FlagManager *flagManager = gg->arenas[arena];
+                if (flagManager && flagManager->reconcileDue(now))
+                {
+                    gg->arenaStateChanged(flagManager->reconcileRoster());
+                    gg->stateDirty = true;
+                    arena++;
+                    return true;
+                }
             }
-            qwinners = qwinners.substr(0, qwinners.length() - 2);
-            
-            const char *lastFlag = possibleFlags[maxFlag].flagName;
-            bz_sendTextMessagef(BZ_SERVER, dest,
-                                "Leading the pack: %s with %s",
-                                qwinners.c_str(), lastFlag);
+            arena = 0;
+            return false;
         }
-        else
+        virtual size_t backlog()
         {
-            bz_sendTextMessagef(BZ_SERVER, dest,
-                                "No leaders yet.  Shoot something!");
+            size_t n = 0;
+            for (int a = 0; a < MAXARENAS; ++a)
+            {
+                if (gg->arenas[a] && gg->arenas[a]->reconcileDue(bz_getCurrentTime())) n++;
+            }
+            return n;
         }
-    }
+    };
 
-    const char *getAssignedFlag(const int playerID)
+    // push the match state to shared memory and to a standby, at most
+    // once a tick - the standby may want a snapshot even if nothing changed
+    class PublishTask : public TickTask
     {
-        AssignedFlagsType::const_iterator i = assignedFlags.find(playerID);
-        if (i == assignedFlags.end())
+    private:
+        GunGame *gg;
+    public:
+        PublishTask(GunGame *g) : gg(g) {}
+        virtual const char *name() { return "publish"; }
+        virtual bool runSlice(double)
         {
-            return NULL;
+            gg->replicator.send(gg->arenas, gg->scoreboard, gg->stateDirty);
+            if (!gg->stateDirty) return false;
+            if (gg->shmPublisher.getName() != bz_getBZDBString("_ggShmName").c_str())
+            {
+                gg->shmPublisher.open(bz_getBZDBString("_ggShmName").c_str());
+            }
+            gg->shmPublisher.publish(gg->arenas, MAXARENAS, gg->scoreboard);
+            gg->stateDirty = false;
+            return false;
         }
-        return possibleFlags[i->second].flagName;
-    }
+        virtual size_t backlog() { return gg->stateDirty ? 1 : 0; }
+    };
 
-    // suicide or natural causes
-    void handleSuicide(const bz_PlayerDieEventData_V1 *dieData)
+    class TraceTask : public TickTask
     {
-        const char *victimName = bz_getPlayerCallsign(dieData->playerID);
-        int victimFlagNo = assignedFlags[dieData->playerID];
-        const char *victimFlag = possibleFlags[victimFlagNo].flagName;
+        GunGame *gg;
+    public:
+        TraceTask(GunGame *g) : gg(g) {}
+        virtual const char *name() { return "trace"; }
+        virtual bool runSlice(double) { return gg->trace.drainOne(); }
+        virtual size_t backlog() { return gg->trace.backlog(); }
+    };
 
-        int decr = 0;
-        int newFlagNo = getPrevFlag(victimFlagNo, decr, bz_getBZDBInt("_ggSuicidePenalty"));
-        if (newFlagNo < 0)
+    // every _ggHintInterval, point each SR holder at their nearest target
+    class HintTask : public TickTask
+    {
+    private:
+        GunGame *gg;
+        list<int> pending;       // SR holders still to hint this round
+        double nextHint;
+
+        static const char *compass(float dx, float dy)
         {
-            newFlagNo = victimFlagNo;
+            static const char *points[] = {"E", "NE", "N", "NW", "W", "SW", "S", "SE"};
+            double deg = atan2(dy, dx) * 180.0 / M_PI;
+            return points[((int)floor((deg + 22.5) / 45.0) + 8) % 8];
         }
-        const char *newFlag = possibleFlags[newFlagNo].flagName;
-#ifdef PLAYSOUNDS
-        bz_sendPlayCustomLocalSound(BZ_ALLUSERS, "flag_lost");
-#endif
-        bz_sendTextMessagef(BZ_SERVER, dieData->playerID, "Ha-Ha!  You suicided with %s.  %s %s",
-                            victimFlag,
-                            (newFlagNo <= firstFlag) ? "starting over with"
-                                                                 : "demoted to",
-                            newFlag);
-        assignedFlags[dieData->playerID] = newFlagNo;
 
-        // reduce player score on suicide
-        if (decr)
+    public:
+        HintTask(GunGame *g) : gg(g), nextHint(0.0) {}
+        virtual const char *name() { return "SR hints"; }
+        virtual bool runSlice(double now)
         {
-            bz_setPlayerWins(dieData->playerID, flagLevels[newFlagNo]);
+            if (pending.empty())
+            {
+                double interval = bz_getBZDBDouble("_ggHintInterval");
+                if ((interval <= 0.0) || (now < nextHint)) return false;
+                nextHint = now + interval;
+                for (int a = 0; a < MAXARENAS; ++a)
+                {
+                    if (gg->arenas[a]) gg->arenas[a]->endgamePlayers(pending);
+                }
+                if (pending.empty()) return false;
+            }
+            int playerID = pending.front();
+            pending.pop_front();
+            float dx = 0.0f, dy = 0.0f;
+            if (gg->grid.nearest(playerID, gg->playerArena, dx, dy) >= 0)
+            {
+                bz_sendTextMessagef(BZ_SERVER, playerID, "Nearest target: %s, %d units",
+                                    compass(dx, dy), (int)sqrtf(dx * dx + dy * dy));
+            }
+            return !pending.empty();
         }
-    }
+        virtual size_t backlog() { return pending.size(); }
+    };
 
-    void handleHomicide(bz_PlayerDieEventData_V1 *dieData)
+    // every kill since the last tick is in - swap flags once per killer
+    // an arena a slice, ahead of the gives they cause
+    class AdvanceTask : public TickTask
     {
-        // on noes! a homicide occurred
-        int killerID = dieData->killerID;
-        int victimID = dieData->playerID;
-        const char *victimName = bz_getPlayerCallsign(victimID);
-        const char *killerName = bz_getPlayerCallsign(killerID);
-        int victimFlagNo = assignedFlags[victimID];
-        int killerFlagNo = assignedFlags[dieData->killerID];
-        const char *victimFlag = possibleFlags[victimFlagNo].flagName;
-        const char *killerFlag = possibleFlags[killerFlagNo].flagName;
-
-        // if someone spams the drop flag key and squeezes of a shot with no flag
-        // ... and if we don't succeed in making the bullet PZ
-        // ... and this results in another player dying
-        // demote and publicly shame the "cheater"
-        //
-        // allow valid cases where flagKilledWith can be empty:
-        //  1 killer has SR (squish)
-        //  2 victim has BU (squish)
-        //  3 victim "just had" BU
-        bool cheat = false;
-        if (bz_getBZDBBool("_ggDetectCheat"))
+    private:
+        GunGame *gg;
+        int arena;
+    public:
+        AdvanceTask(GunGame *g) : gg(g), arena(0) {}
+        virtual const char *name() { return "advances"; }
+        virtual bool runSlice(double)
         {
-            // was there no flag?
-            if (dieData->flagKilledWith.size() == 0)
+            for (; arena < MAXARENAS; ++arena)
             {
-                // exempt server and admin
-                // those are always "OK"
-                if ((killerID != 253) && (killerID != 252))
+                if (gg->arenas[arena] && gg->arenas[arena]->numPendingAdvances())
                 {
-                    if ((string(killerFlag) != "SR") && (string(victimFlag) != "BU"))
-                    {
-                        if (bz_getBZDBBool("_ggDebug"))
-                        {
-                            bz_sendTextMessagef(BZ_SERVER, debuggerID, "Possible cheating? Killed without flag, not SR or BU.");
-                        }
-                        // if victim Z < 0, was coming out of BU -- not a cheat
-                        if (dieData->state.pos[2] >= 0)
-                        {
-                            // this is as sure as we can be that "cheat" happened
-                            cheat = true;
-                            int decr = 0;
-                            int newFlagNo = getPrevFlag(killerFlagNo, decr, bz_getBZDBInt("_ggCheatPenalty"));
-                            if (newFlagNo < 0)
-                            {
-                                newFlagNo = firstFlag;
-                            }
-                            const char *newFlag = possibleFlags[newFlagNo].flagName;
-                            bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS, "%s killed %s ... WITHOUT holding %s!  Booted to %s",
-                                                killerName, victimName, killerFlag, newFlag);
-                            assignedFlags[killerID] = newFlagNo;
-                            // negate cheater score increase
-                            // and roll it back 
-                            bz_setPlayerWins(killerID, flagLevels[newFlagNo] - 1);
-                            // if cheater died, do nothing - new flag will be given on spawn
-                            replaceFlagIfAlive(killerID, newFlag, "suspected cheat", true);
-                        }
-                    }
+                    gg->arenas[arena++]->applyAdvances();
+                    return true;
                 }
             }
+            arena = 0;
+            return false;
         }
-        if (!cheat)
+        virtual size_t backlog()
         {
-            // legit kill!
-            if (bz_getBZDBBool("_ggJacked"))
+            size_t n = 0;
+            for (int a = 0; a < MAXARENAS; ++a)
             {
-                bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS, "%s got JACKED by %s with %s",
-                                    victimName, killerName, killerFlag);
+                if (gg->arenas[a]) n += gg->arenas[a]->numPendingAdvances();
             }
+            return n;
+        }
+    };
+
+    // standby: apply what the primary sent, and take over once it is gone
+    class ReplicaTask : public TickTask
+    {
+    private:
+        GunGame *gg;
+    public:
+        ReplicaTask(GunGame *g) : gg(g) {}
+        virtual const char *name() { return "replica"; }
+        virtual bool runSlice(double)
+        {
+            if (gg->replicator.receive()) gg->takeOver();
+            return false;
+        }
+        virtual size_t backlog() { return 0; }
+    };
+
+    // spill rebuilds - a full, moved or resized spill is copied a slice
+    // at a time, never on the kill path
+    class SpillTask : public TickTask
+    {
+    private:
+        GunGame *gg;
+    public:
+        SpillTask(GunGame *g) : gg(g) {}
+        virtual const char *name() { return "spill"; }
+        virtual bool runSlice(double) { return gg->scoreboard.compactSlice(); }
+        virtual size_t backlog() { return gg->scoreboard.compactBacklog(); }
+    };
+
+    // the BZDB settings the plugin keeps copies of - 40-odd lookups, so
+    // only re-read after a bz_eBZDBChange, not every tick
+    class SettingsTask : public TickTask
+    {
+    private:
+        GunGame *gg;
+    public:
+        SettingsTask(GunGame *g) : gg(g) {}
+        virtual const char *name() { return "settings"; }
+        virtual bool runSlice(double)
+        {
+            if (gg->settingsDirty) gg->applySettings();
+            return false;
+        }
+        virtual size_t backlog() { return gg->settingsDirty ? 1 : 0; }
+    };
+
+    AdvanceTask *advanceTask;
+    ReplicaTask *replicaTask;
+    SettingsTask *settingsTask;
+    SpillTask *spillTask;
+    DelayedGiveTask *giveTask;
+    RosterTask *rosterTask;
+    PublishTask *publishTask;
+    TraceTask *traceTask;
+    HintTask *hintTask;
+    Tracer trace;                // debug trace ring, drained by traceTask
+    Tracer *tracer;              // &trace - what the TRACE_ macros go through
+    GiveLatency gives;           // how long players wait for flags, see /gggives
+    PlayerGrid grid;             // live players' positions, for SR hints
+    ShmPublisher shmPublisher;
+    bool stateDirty;             // something published has changed
+    Replicator replicator;
+    bool settingsDirty;          // a BZDB value changed since applySettings
+    int tickBudget;              // _ggTickBudget
+
+    void applySettings()
+    {
+        settingsDirty = false;
+        tickBudget = bz_getBZDBInt("_ggTickBudget");
+        // settings used on the shot path are kept here, not read per shot
+        cheatWatch.window = bz_getBZDBDouble("_ggDropShotWindow");
+        cheatWatch.threshold = bz_getBZDBDouble("_ggSuspectLevel");
+        shotGuard.configure();
+        trace.configure();
+        float worldSize = bz_getBZDBDouble("_worldSize");
+        if ((worldSize > 0.0f) && (worldSize != grid.worldSize())) grid.resize(worldSize);
+        bz_ApiString winnersFile = bz_getBZDBString("_ggWinnersFile");
+        if (scoreboard.global.getPath() != winnersFile.c_str())
+        {
+            scoreboard.global.open(winnersFile.c_str());
+        }
+        scoreboard.configure(bz_getBZDBInt("_ggMaxWinners"), bz_getBZDBInt("_ggMaxSpill"),
+                             bz_getBZDBString("_ggWinnersSpill").c_str());
+        replicator.configure(bz_getBZDBString("_ggReplicaSocket").c_str(), bz_getBZDBBool("_ggReplicaStandby"));
+    }
+
+    // where players of a primary this standby took over left off
+    struct Resume
+    {
+        int arena;
+        int flag;
+        double matchStart;
+    };
+    typedef map<string, Resume> ResumesType;
+    ResumesType resumes;         // by callsign, until they join or resumeUntil
+    double resumeUntil;
+
+    // the primary is gone - its players can come back here for a while
+    // at the flag they had, and its winners keep their wins
+    void takeOver()
+    {
+        resumes.clear();
+        for (int p = 0; p < MAXPLAYERS; ++p)
+        {
+            const Replicator::ShadowPlayer &sp = replicator.players[p];
+            if (!sp.present || sp.callsign.empty() || (sp.flag < 0)) continue;
+            Resume &r = resumes[sp.callsign];
+            r.arena = sp.arena;
+            r.flag = sp.flag;
+            r.matchStart = replicator.shadowArenas[sp.arena].matchStart;
+        }
+        for (map<string, int>::const_iterator w = replicator.winners.begin(); w != replicator.winners.end(); ++w)
+        {
+            scoreboard.restore(w->first.c_str(), w->second);
+        }
+        resumeUntil = bz_getCurrentTime() + REPLRESUMESEC;
+        stateDirty = true;
+        bz_debugMessagef(0, "GunGame: primary gone - taking over its match, %d players can pick up where they were",
+                         (int)resumes.size());
+    }
 
-            int killerLevel = flagLevels[killerFlagNo];
-            int maxLevel = numEnabledFlags;
-            int remainLevels = maxLevel - killerLevel;
+    // a saved flag only goes to a registered callsign whose owner has
+    // identified - anyone can join with an unregistered one
+    ResumesType::iterator resumeFor(const bz_PlayerJoinPartEventData_V1 *joinData)
+    {
+        if (resumes.empty() || !joinData->record || !joinData->record->verified) return resumes.end();
+        const char *callsign = bz_getPlayerCallsign(joinData->playerID);
+        return callsign ? resumes.find(callsign) : resumes.end();
+    }
 
-            // advance the killer... detect win case, etc
-            if (killerLevel < maxLevel)
-            {
-                if (remainLevels <= MAJORWARN)
-                {
-#ifdef PLAYSOUNDS
-                    bz_sendPlayCustomLocalSound(BZ_ALLUSERS, "flag_alert");
-#endif
-                    bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS, 
-                                        "--->>> ATTENTION: %s is ABOUT TO WIN!!! <<<---",
-                                        killerName);
-                                        
-                }
-                else if (remainLevels <= MINORWARN)
-                {
-#ifdef PLAYSOUNDS
-                    bz_sendPlayCustomLocalSound(BZ_ALLUSERS, "lock");
-#endif
-                    bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS,
-                                        "-> ATTENTION: %s has %d KILLS REMAINING!!! <-",
-                                        killerName, remainLevels);
-                }
+    FlagManager *arenaOf(int playerID)
+    {
+        if ((playerID < 0) || (playerID >= MAXPLAYERS) || (playerArena[playerID] < 0))
+        {
+            return NULL;
+        }
+        return arenas[playerArena[playerID]];
+    }
 
-                int adv = 0;
-                int newFlagNo = getNextFlag(killerFlagNo, adv, 1);
-                if (bz_getBZDBBool("_ggDebug"))
-                {
-                    bz_sendTextMessagef(BZ_SERVER, debuggerID,
-                                    "-> ATTENTION: %s made a legit kill. new flag is %d which is level %d",
-                                    killerName, newFlagNo, flagLevels[newFlagNo]);
-                }
-                assignedFlags[killerID] = newFlagNo;
+    // by team colour, or into whichever arena is short of players
+    int pickArena(const bz_PlayerJoinPartEventData_V1 *joinData)
+    {
+        int numArenas = bz_getBZDBInt("_ggArenas");
+        if (numArenas < 1) numArenas = 1;
+        if (numArenas > MAXARENAS) numArenas = MAXARENAS;
 
-                // set score to new level (minus one to account for pending increment)
-                bz_setPlayerWins(killerID, flagLevels[newFlagNo] - 1);
-                const char *newFlag = possibleFlags[newFlagNo].flagName;
-                bz_sendTextMessagef(BZ_SERVER, killerID, "\"Upgraded\" from %s to %s (%d/%d)", killerFlag, newFlag, killerLevel+1, maxLevel);
-#ifdef PLAYSOUNDS
-                bz_sendPlayCustomLocalSound(killerID, "gungame/gungame_boost");
-#endif
-                replaceFlagIfAlive(killerID, newFlag, "advancing");
-            }
-            else
+        int arena = 0;
+        int team = joinData->record ? joinData->record->team : eRogueTeam;
+        ResumesType::const_iterator r = resumeFor(joinData);
+        if ((r != resumes.end()) && (r->second.arena < numArenas))
+        {
+            // back to the arena they were playing in
+            arena = r->second.arena;
+        }
+        else if (bz_getBZDBBool("_ggArenaByTeam") && (team >= eRedTeam) && (team <= ePurpleTeam))
+        {
+            // red, green, blue, purple - each colour its own arena while there are enough
+            arena = (team - eRedTeam) % numArenas;
+        }
+        else
+        {
+            // rogues (and everyone when not by team) balance out
+            size_t fewest = 0;
+            for (int a = 0; a < numArenas; ++a)
             {
-                // winner!
-                bz_sendTextMessagef(BZ_SERVER, BZ_ALLUSERS, "---===>>> WINNER: %s <<<===---",
-                                    killerName);
-                addWinner(killerName);
-                announceWinners(BZ_ALLUSERS);
-
-                // reset game
-                int winnerFlag = assignedFlags[killerID];
-                int firstFlag = getNextFlag(-1);
-                const char *firstFlagName = possibleFlags[firstFlag].flagName;
-                for (AssignedFlagsType::iterator i = assignedFlags.begin(); i!= assignedFlags.end(); ++i)
+                size_t n = arenas[a] ? arenas[a]->rosterSize() : 0;
+                if ((a == 0) || (n < fewest))
                 {
-                    int playerID = i->first;
-                    int flag = i->second;
-                    // reset scores
-                    bz_setPlayerWins(i->first, 0); // will increment to 1 due to kill
-                    bz_setPlayerLosses(i->first, 0);
-                    bz_setPlayerTKs(i->first, 0);
-                    i->second = firstFlag;
-                    if (playerID != killerID)
-                    {
-                        if (flag == winnerFlag)
-                        {
-#ifdef PLAYSOUNDS
-                            bz_sendPlayCustomLocalSound(playerID, "phantom");
-                            bz_sendPlayCustomLocalSound(playerID, "flag_won");
-#endif
-                            bz_sendTextMessagef(BZ_SERVER, playerID, "So close!  %s just beat you", killerName);
-                        }
-                        else
-                        {
-#ifdef PLAYSOUNDS
-                            bz_sendPlayCustomLocalSound(playerID, "flag_won");
-#endif
-                            bz_sendTextMessagef(BZ_SERVER, playerID, "Bow to %s", killerName);
-                        }
-                        // kill all non-winners
-                        // spawn will reset their flag
-                        bz_killPlayer(playerID, false);
-                    }
-                    else
-                    {
-#ifdef PLAYSOUNDS
-                        bz_sendPlayCustomLocalSound(playerID, "gungame/gungame_sexy");
-                        bz_sendPlayCustomLocalSound(playerID, "flag_won");
-#endif
-                        bz_sendTextMessagef(BZ_SERVER, playerID, "Nice game %s!", killerName);
-                        replaceFlagIfAlive(playerID, firstFlagName, "winning");
-                    }
+                    fewest = n;
+                    arena = a;
                 }
             }
         }
+
+        if (!arenas[arena])
+        {
+            arenas[arena] = new FlagManager(arena, &scoreboard, tracer, &gives);
+            arenas[arena]->debuggerID = debuggerID;
+            if (arena > 0) FlagManager::sharded = true;
+        }
+        return arena;
     }
-};
 
-class GunGame : public bz_Plugin, public bz_CustomSlashCommandHandler
-{
-private:
-    FlagManager *flagManager;
-    const char *debuggerIP;
-    bool savedHideFlagsOnRadar;
-    bool savedShotMismatch;
+    // spawn/die/drop/shot handling only needed while some arena is playing
+    void arenaStateChanged(int change)
+    {
+        if ((change > 0) && (numArenasOn++ == 0))
+        {
+            savedShotMismatch = bz_getShotMismatch();
+            bz_setShotMismatch(false);
+            Register(bz_ePlayerSpawnEvent);
+            Register(bz_ePlayerDieEvent);
+            Register(bz_eFlagDroppedEvent);
+            Register(bz_eShotFiredEvent);
+            Register(bz_ePlayerUpdateEvent);
+        }
+        else if ((change < 0) && (--numArenasOn == 0))
+        {
+            bz_setShotMismatch(savedShotMismatch);
+            Remove(bz_ePlayerSpawnEvent);
+            Remove(bz_ePlayerDieEvent);
+            Remove(bz_eFlagDroppedEvent);
+            Remove(bz_eShotFiredEvent);
+            Remove(bz_ePlayerUpdateEvent);
+            grid.resize(grid.worldSize());
+        }
+    }
 
    virtual bool SlashCommand ( int playerID, bz_ApiString command, bz_ApiString message, bz_APIStringList *params )
    {
+       FlagManager *flagManager = arenaOf(playerID);
+       if (!flagManager) flagManager = arenas[0];
+
+       bz_ApiString firstParam = (params && params->size()) ? params->get(0) : bz_ApiString("");
+       const char *arg = firstParam.c_str();
+
        if (command == "flags")
        {
-           if (flagManager)
+           if (flagManager && commandAllowed(playerID))
            {
-               flagManager->listFlags(playerID);
+               flagManager->listFlags(playerID, 0 == strcasecmp(arg, "compact"));
            }
        }
        else if (command == "winners")
        {
-           if (flagManager)
+           if (flagManager && commandAllowed(playerID))
            {
-               flagManager->announceWinners(playerID);
+               flagManager->announceWinners(playerID, *arg ? atoi(arg) : 1);
            }
        }
        else if (command == "leaders")
        {
-           if (flagManager)
+           if (flagManager && commandAllowed(playerID))
            {
                flagManager->announceLeaders(playerID);
            }
        }
+       else if (command == "ggsuspects")
+       {
+           if (bz_getAdmin(playerID))
+           {
+               cheatWatch.report(playerID, bz_getCurrentTime());
+           }
+       }
+       else if (command == "ggshots")
+       {
+           if (bz_getAdmin(playerID))
+           {
+               shotGuard.report(playerID);
+           }
+       }
+       else if (command == "ggsched")
+       {
+           if (bz_getAdmin(playerID))
+           {
+               scheduler.report(playerID);
+           }
+       }
+       else if (command == "ggmem")
+       {
+           if (bz_getAdmin(playerID))
+           {
+               reportMemory(playerID);
+           }
+       }
+       else if (command == "ggmulti")
+       {
+           if (bz_getAdmin(playerID))
+           {
+               reportMultiKills(playerID);
+           }
+       }
+       else if (command == "gggives")
+       {
+           if (bz_getAdmin(playerID))
+           {
+               gives.report(playerID, arg);
+           }
+       }
+       else if (command == "ggrepl")
+       {
+           if (bz_getAdmin(playerID))
+           {
+               replicator.report(playerID);
+               if (!resumes.empty())
+               {
+                   bz_sendTextMessagef(BZ_SERVER, playerID, "  %d players still to come back, for %.0fs",
+                                       (int)resumes.size(), resumeUntil - bz_getCurrentTime());
+               }
+           }
+       }
        else
        {
            return false;
@@ -830,6 +4346,59 @@ private:
    }
 
 public:
+    // every arena's invariants, plus player routing - see FlagManager
+    bool checkInvariants(string &why)
+    {
+        char msg[160];
+        size_t routed = 0, rostered = 0;
+        int playing = 0;
+        for (int p = 0; p < MAXPLAYERS; ++p)
+        {
+            bool connected = bz_getPlayerCallsign(p) != NULL;
+            FlagManager *flagManager = arenaOf(p);
+            if (playerArena[p] >= 0) routed++;
+            if ((connected != (playerArena[p] >= 0)) || (flagManager && !flagManager->hasPlayer(p)) ||
+                ((playerArena[p] >= 0) && !flagManager))
+            {
+                snprintf(msg, sizeof(msg), "player %d %s but routed to arena %d",
+                         p, connected ? "connected" : "gone", playerArena[p]);
+                why = msg;
+                return false;
+            }
+            if (!connected && gives.waiting(p))
+            {
+                snprintf(msg, sizeof(msg), "player %d gone but still waiting for a flag", p);
+                why = msg;
+                return false;
+            }
+        }
+        for (int a = 0; a < MAXARENAS; ++a)
+        {
+            if (!arenas[a]) continue;
+            if (!arenas[a]->checkInvariants(why))
+            {
+                snprintf(msg, sizeof(msg), "arena %d: ", a + 1);
+                why = msg + why;
+                return false;
+            }
+            rostered += arenas[a]->rosterSize();
+            if (arenas[a]->gameOn()) playing++;
+        }
+        if (rostered != routed)
+        {
+            snprintf(msg, sizeof(msg), "%d players routed but %d in arenas", (int)routed, (int)rostered);
+            why = msg;
+            return false;
+        }
+        if (playing != numArenasOn)
+        {
+            snprintf(msg, sizeof(msg), "%d arenas playing but %d counted on", playing, numArenasOn);
+            why = msg;
+            return false;
+        }
+        return scoreboard.checkInvariants(why);
+    }
+
     virtual const char* Name (){return "GunGame";}
     virtual void Init ( const char* config)
     {
@@ -841,26 +4410,130 @@ public:
         bz_setBZDBBool("_ggDetectCheat", true, 0, false);
         bz_setBZDBInt("_ggSuicidePenalty", SUICIDEPENALTY, 0, false);
         bz_setBZDBInt("_ggCheatPenalty", CHEATPENALTY, 0, false);
+        bz_setBZDBInt("_ggArenas", 1, 0, false);
+        bz_setBZDBBool("_ggArenaByTeam", false, 0, false);
+        bz_setBZDBInt("_ggTickBudget", TICKBUDGET, 0, false);
+        bz_setBZDBDouble("_ggDropShotWindow", DROPSHOTWINDOW, 0, false);
+        bz_setBZDBDouble("_ggSuspectLevel", SUSPECTLEVEL, 0, false);
+        bz_setBZDBInt("_ggMaxShots", MAXSHOTS, 0, false);
+        bz_setBZDBDouble("_ggShotSlack", SHOTSLACK, 0, false);
+        bz_setBZDBString("_ggWinnersFile", "", 0, false);
+        bz_setBZDBDouble("_ggCommandCooldown", COMMANDCOOLDOWN, 0, false);
+        bz_setBZDBInt("_ggMaxWinners", MAXWINNERS, 0, false);
+        bz_setBZDBInt("_ggMaxSpill", MAXSPILL, 0, false);
+        bz_setBZDBString("_ggReplicaSocket", "", 0, false);
+        bz_setBZDBBool("_ggReplicaStandby", false, 0, false);
 
         bz_registerCustomSlashCommand("flags", this);
         bz_registerCustomSlashCommand("winners", this);
         bz_registerCustomSlashCommand("leaders", this);
+        bz_registerCustomSlashCommand("ggsched", this);
+        bz_registerCustomSlashCommand("ggsuspects", this);
+        bz_registerCustomSlashCommand("ggshots", this);
+        bz_registerCustomSlashCommand("ggmem", this);
+        bz_registerCustomSlashCommand("ggmulti", this);
+        bz_registerCustomSlashCommand("gggives", this);
+        bz_registerCustomSlashCommand("ggrepl", this);
         debuggerIP = config;
-        flagManager = new FlagManager();
+        debuggerID = BZ_ALLUSERS;
+        tracer = &trace;
+        gives.attach(tracer);
+        numArenasOn = 0;
+        resumeUntil = 0.0;
+        for (int a = 0; a < MAXARENAS; ++a) arenas[a] = NULL;
+        for (int p = 0; p < MAXPLAYERS; ++p)
+        {
+            playerArena[p] = -1;
+            lastCommand[p] = -COMMANDCOOLDOWN;
+            cooldownWarned[p] = false;
+        }
+        arenas[0] = new FlagManager(0, &scoreboard, tracer, &gives);
+
+        // advances and the gives they cause always go first - players are
+        // unarmed until they land
+        advanceTask = new AdvanceTask(this);
+        giveTask = new DelayedGiveTask(this);
+        replicaTask = new ReplicaTask(this);
+        rosterTask = new RosterTask(this);
+        scheduler.add(advanceTask, TASK_ADVANCES);
+        scheduler.add(giveTask, TASK_GIVES);
+        scheduler.add(replicaTask, TASK_REPLICA);
+        scheduler.add(rosterTask, TASK_ROSTER);
+
+        char shmName[64];
+        snprintf(shmName, sizeof(shmName), "/gunGame.%d", bz_getPublicPort());
+        bz_setBZDBString("_ggShmName", shmName, 0, false);
+        snprintf(shmName, sizeof(shmName), "gunGame.%d.spill", bz_getPublicPort());
+        bz_setBZDBString("_ggWinnersSpill", shmName, 0, false);
+        stateDirty = true;
+        publishTask = new PublishTask(this);
+        scheduler.add(publishTask, TASK_PUBLISH);
+
+        bz_setBZDBString("_ggTrace", "", 0, false);
+        bz_setBZDBBool("_ggTraceChat", true, 0, false);
+        bz_setBZDBString("_ggTraceFile", "", 0, false);
+        trace.chatDest = debuggerID;
+        traceTask = new TraceTask(this);
+        scheduler.add(traceTask, TASK_TRACE);
+
+        bz_setBZDBDouble("_ggHintInterval", HINTSEC, 0, false);
+        grid.resize(bz_getBZDBDouble("_worldSize"));
+        hintTask = new HintTask(this);
+        scheduler.add(hintTask, TASK_HINTS);
+        spillTask = new SpillTask(this);
+        scheduler.add(spillTask, TASK_SPILL);
+
+        // the defaults above now, after that only when one changes
+        applySettings();
+        settingsTask = new SettingsTask(this);
+        scheduler.add(settingsTask, TASK_SETTINGS);
 
         Register(bz_ePlayerJoinEvent);
         Register(bz_ePlayerPartEvent);
+        Register(bz_eTickEvent);
+        Register(bz_eBZDBChange);
     }
     void Cleanup()
     {
-        if (flagManager) 
+        for (int a = 0; a < MAXARENAS; ++a)
         {
-            delete flagManager;
-            flagManager = NULL;
+            delete arenas[a];
+            arenas[a] = NULL;
         }
+        FlagManager::sharded = false;
         bz_removeCustomSlashCommand("flags");
         bz_removeCustomSlashCommand("winners");
         bz_removeCustomSlashCommand("leaders");
+        bz_removeCustomSlashCommand("ggsched");
+        bz_removeCustomSlashCommand("ggsuspects");
+        bz_removeCustomSlashCommand("ggshots");
+        bz_removeCustomSlashCommand("ggmem");
+        bz_removeCustomSlashCommand("ggmulti");
+        bz_removeCustomSlashCommand("gggives");
+        bz_removeCustomSlashCommand("ggrepl");
+        scheduler.remove(giveTask);
+        scheduler.remove(rosterTask);
+        scheduler.remove(publishTask);
+        scheduler.remove(traceTask);
+        scheduler.remove(hintTask);
+        scheduler.remove(advanceTask);
+        scheduler.remove(replicaTask);
+        scheduler.remove(settingsTask);
+        scheduler.remove(spillTask);
+        delete giveTask;
+        delete rosterTask;
+        delete publishTask;
+        delete traceTask;
+        delete hintTask;
+        delete advanceTask;
+        delete replicaTask;
+        delete settingsTask;
+        delete spillTask;
+        trace.close();
+        shmPublisher.close();
+        replicator.stop();
+        scoreboard.global.close();
+        scoreboard.dropSpill();
         bz_Plugin::Cleanup();
         bz_setBZDBBool("_hideFlagsOnRadar", savedHideFlagsOnRadar, 0, false);
     }
@@ -872,42 +4545,52 @@ BZ_PLUGIN(GunGame)
 
 void GunGame::Event ( bz_EventData *eventData )
 {
-    // sometimes a flag give fails (for example if we just took it)
-    // handle this with a delayed give
     if (eventData->eventType == bz_eTickEvent)
     {
         bz_TickEventData_V1 *tickData = (bz_TickEventData_V1*)eventData;
-        FlagManager::DelayedFlagsType::iterator e = flagManager->delayedFlags.end();
-        for (FlagManager::DelayedFlagsType::iterator i = flagManager->delayedFlags.begin();
-             i != e; ++i)
-        {
-            if (i->second.flag)
-            {
-                if (tickData->eventTime > i->second.givetime)
-                {
-                // timer has expired - try to give the flag now
-                // if that still fails, reset timer
-                    if (flagManager->givePlayerFlagNow(i->first, i->second.flag))
-                    {
-                        i->second.flag = NULL;
-                    }
-                    else
-                    {
-                        i->second.givetime = tickData->eventTime + RETRYSEC;
-                    }
-                }
-            }
-        }
+        // all of the tick's work is on the scheduler, inside the budget
+        scheduler.run(tickData->eventTime, tickBudget);
+    }
+
+    else if (eventData->eventType == bz_eBZDBChange)
+    {
+        settingsDirty = true;
     }
 
     else if (eventData->eventType == bz_eShotFiredEvent)
     {
         bz_ShotFiredEventData_V1 *shotData = (bz_ShotFiredEventData_V1*)eventData;
+        FlagManager *flagManager = arenaOf(shotData->playerID);
+        if (!flagManager)
+        {
+            // example: a world weapon
+            // do nothing
+            TRACE_DETAIL(TRACE_SHOTS, TE_WORLDSHOT, -1, 0, 0, NULL, NULL);
+            return;
+        }
+        // an arena still waiting for players plays like a plain server
+        if (!flagManager->gameOn()) return;
         const char *shootingPlayer = bz_getPlayerCallsign(shotData->playerID);
 
         bz_BasePlayerRecord *pr = bz_getPlayerByIndex(shotData->playerID);
         if (pr)
         {
+            if (cheatWatch.shot(shotData->playerID, shotData->eventTime, pr->currentFlag.size() > 0))
+            {
+                // shooting on the heels of drops - neutralize and tell the admins
+                shotData->changed = true;
+                shotData->type = "PZ";
+                int confidence = (int)(100.0 * cheatWatch.confidence(shotData->playerID, shotData->eventTime) + 0.5);
+                for (int p = 0; p < MAXPLAYERS; ++p)
+                {
+                    if ((p != debuggerID) && bz_getAdmin(p))
+                    {
+                        bz_sendTextMessagef(BZ_SERVER, p, "Drop-shoot suspect: %s (%d%% confidence) - see /ggsuspects",
+                                            shootingPlayer, confidence);
+                    }
+                }
+                TRACE_WARN(TRACE_CHEAT, TE_SUSPECT, shotData->playerID, confidence, 0, NULL, NULL);
+            }
             if(!pr->currentFlag.size())
             {
                 // if no flag - change bullet to PZ 
@@ -915,30 +4598,32 @@ void GunGame::Event ( bz_EventData *eventData )
                 // so we catch ill-gotten kills elsewhere and dispense justice there
                 shotData->changed = true;
                 shotData->type = "PZ";
-                if (bz_getBZDBBool("_ggDebug"))
-                {
-                    bz_sendTextMessagef(BZ_SERVER, flagManager->debuggerID,
-                                        ">>>>>>> %s fired a shot... but has no flag - made it PZ <<<<<",
-                                        shootingPlayer);
-                }
+                TRACE_INFO(TRACE_SHOTS, TE_SHOTNOFLAG, shotData->playerID, 0, 0, NULL, NULL);
             }
             else
             {
-                // check flag type
-                const char *shouldHave = flagManager->getAssignedFlag(shotData->playerID);
-                if (shotData->type != shouldHave)
+                // check flag type - against the flag held, which lags the
+                // ladder until this tick's advances are applied
+                int shouldHaveNo = flagManager->getHeldFlagNo(shotData->playerID);
+                const char *shouldHave = (shouldHaveNo >= 0) ? possibleFlags[shouldHaveNo].flagName : NULL;
+                if (!shouldHave)
+                {
+                    // not on the ladder yet (joined since the last roster) - leave it
+                }
+                else if (shotData->type != shouldHave)
                 {
                     // shooter had a flag...  was it the right one?
                     // I've never seen this actually happen
+                    TRACE_WARN(TRACE_SHOTS, TE_SHOTTYPE, shotData->playerID, 0, 0, shotData->type.c_str(), shouldHave);
                     shotData->changed = true;
                     shotData->type = "PZ";
-                    if (bz_getBZDBBool("_ggDebug"))
-                    {
-                        bz_sendTextMessagef(BZ_SERVER, 
-                                        flagManager->debuggerID,
-                                        ">>>>>>> %s shot type: %s should have been: %s - made it PZ <<<<<<",
-                                        shootingPlayer, shotData->type.c_str(), shouldHave);
-                    }
+                }
+                // right flag, but firing faster than it can reload
+                else if (!shotGuard.allow(shotData->playerID, shouldHaveNo, shotData->eventTime))
+                {
+                    shotData->changed = true;
+                    shotData->type = ENDSHOTTYPE;
+                    TRACE_WARN(TRACE_SHOTS, TE_SHOTRATE, shotData->playerID, 0, 0, shouldHave, NULL);
                 }
                 // also if SR - end game situation - disable gun in same way
                 else if((flagManager->numPlayers >= REQUIRECRUSH) && (pr->currentFlag == "SteamRoller (+SR)"))
@@ -949,17 +4634,6 @@ void GunGame::Event ( bz_EventData *eventData )
                 }
             }
         }
-        else
-        {
-            // example: a world weapon
-            // do nothing
-            if (bz_getBZDBBool("_ggDebug"))
-            {
-                bz_sendTextMessagef(BZ_SERVER, 
-                                flagManager->debuggerID,
-                                ">>>>>>> No Player ID for shot - world weapon?");
-            }
-        }
         bz_freePlayerRecord(pr);
     }
 
@@ -967,6 +4641,8 @@ void GunGame::Event ( bz_EventData *eventData )
     else if (eventData->eventType == bz_eFlagDroppedEvent)
     {
         bz_FlagDroppedEventData_V1 *playerData = (bz_FlagDroppedEventData_V1*)eventData;
+        FlagManager *flagManager = arenaOf(playerData->playerID);
+        if (!flagManager || !flagManager->gameOn()) return;
         const char *dropPlayer = bz_getPlayerCallsign(playerData->playerID);
         bz_BasePlayerRecord *pr = bz_getPlayerByIndex(playerData->playerID);
         if (pr)
@@ -974,33 +4650,31 @@ void GunGame::Event ( bz_EventData *eventData )
             if (pr->spawned) 
             {
                 // player dropped while alive
-                const char *droppedFlag = bz_getFlagName(playerData->flagID).c_str();
-                const char *shouldHave = flagManager->getAssignedFlag(playerData->playerID);
+                // keep the name alive - c_str() of the returned temporary dangles
+                bz_ApiString droppedName = bz_getFlagName(playerData->flagID);
+                const char *droppedFlag = droppedName.c_str();
+                int heldNo = flagManager->getHeldFlagNo(playerData->playerID);
+                const char *shouldHave = (heldNo >= 0) ? possibleFlags[heldNo].flagName : NULL;
                 if (shouldHave)
                 {
                     if (0 == strncmp(droppedFlag, shouldHave, strlen(droppedFlag)))
                     {
-                        if (bz_getBZDBBool("_ggDebug"))
-                        {
-                            bz_sendTextMessagef(BZ_SERVER, flagManager->debuggerID, "%s dropped %s while alive", dropPlayer, droppedFlag);
-                        }
+                        TRACE_INFO(TRACE_FLAGS, TE_DROPALIVE, playerData->playerID, 0, 0, droppedFlag, NULL);
                         // happens if a player dies (before die event)
                         // OR if they try to drop their flag
                         // either way, give them that flag back
-                        bool res = flagManager->givePlayerFlag(playerData->playerID, droppedFlag);
-                        if (bz_getBZDBBool("_ggDebug"))
-                        {
-                            bz_sendTextMessagef(BZ_SERVER, flagManager->debuggerID, "Immediate re-gift success? %s", res ? "yes" : "no");
-                        }
+                        cheatWatch.dropped(playerData->playerID, playerData->eventTime);
+                        gives.begin(playerData->playerID, GIVE_DROP, bz_getCurrentTime());
+                        bool res = flagManager->givePlayerFlag(playerData->playerID, shouldHave);
+                        if (res) cheatWatch.regiven(playerData->playerID, playerData->eventTime);
+                        TRACE_DETAIL(TRACE_FLAGS, TE_REGIVE, playerData->playerID, res, 0, NULL, NULL);
                     }
-                    else if (bz_getBZDBBool("_ggDebug"))
+                    else
                     {
                         // happens if plugin removed their flag
                         // after upgrading state to a new one
                         // plugin will also assign next flag
-                        bz_sendTextMessagef(BZ_SERVER, flagManager->debuggerID,
-                                            "%s dropped: %s to upgrade to: %s",
-                                            dropPlayer, droppedFlag, shouldHave);
+                        TRACE_DETAIL(TRACE_FLAGS, TE_DROPUPGRADE, playerData->playerID, 0, 0, droppedFlag, shouldHave);
                     }
                 }
             }
@@ -1018,6 +4692,27 @@ void GunGame::Event ( bz_EventData *eventData )
         // handle suicides (go back one flag)
         // and extra taunting
         bz_PlayerDieEventData_V1 *dieData = (bz_PlayerDieEventData_V1*)eventData;
+        FlagManager *flagManager = arenaOf(dieData->playerID);
+        if (!flagManager) return;
+        FlagManager *killerArena = arenaOf(dieData->killerID);
+
+        if (!flagManager->gameOn())
+        {
+            // a waiting arena plays like a plain server - only a killer
+            // playing a match of their own mustn't score for it
+            if (killerArena && (killerArena != flagManager) && killerArena->gameOn())
+            {
+                bz_setPlayerWins(dieData->killerID, bz_getPlayerWins(dieData->killerID) - 1);
+                bz_sendTextMessagef(BZ_SERVER, dieData->killerID, "%s is in another arena - no credit",
+                                    bz_getPlayerCallsign(dieData->playerID));
+            }
+            return;
+        }
+
+        stateDirty = true;
+        grid.remove(dieData->playerID);
+        gives.end(dieData->playerID);
+        cheatWatch.died(dieData->playerID, dieData->eventTime);
 
         // losses score will have been incremented... undo that
         bz_setPlayerLosses(dieData->playerID, bz_getPlayerLosses(dieData->playerID) - 1);
@@ -1027,18 +4722,55 @@ void GunGame::Event ( bz_EventData *eventData )
         {
             flagManager->handleSuicide(dieData);
         }
-        else
+        else if ((dieData->killerID == 253) || (dieData->killerID == 252))
+        {
+            // world weapon or the server - not a player, so nobody to credit
+            // and nothing to take back from the victim
+        }
+        else if (killerArena == flagManager)
         {
             flagManager->handleHomicide(dieData);
         }
+        else
+        {
+            // killed by someone playing another match - doesn't count either way
+            // the killer's score is about to be incremented too... cancel that
+            bz_setPlayerWins(dieData->killerID, bz_getPlayerWins(dieData->killerID) - 1);
+            bz_sendTextMessagef(BZ_SERVER, dieData->killerID, "%s is in another arena - no credit",
+                                bz_getPlayerCallsign(dieData->playerID));
+        }
+    }
+
+    // only kept for SR hints - has to stay cheap, there are a lot of these
+    else if (eventData->eventType == bz_ePlayerUpdateEvent)
+    {
+        bz_PlayerUpdateEventData_V1 *updateData = (bz_PlayerUpdateEventData_V1*)eventData;
+        // death takes players off the grid - a dead tank's last packets
+        // mustn't bring it back.  anyone not on it (the grid was emptied
+        // while they lived) is checked against their record
+        if (arenaOf(updateData->playerID))
+        {
+            bool alive = grid.contains(updateData->playerID);
+            if (!alive)
+            {
+                bz_BasePlayerRecord *pr = bz_getPlayerByIndex(updateData->playerID);
+                alive = pr && pr->spawned;
+                bz_freePlayerRecord(pr);
+            }
+            if (alive) grid.update(updateData->playerID, updateData->state.pos[0], updateData->state.pos[1]);
+        }
     }
 
     else if (eventData->eventType == bz_ePlayerSpawnEvent)
     {
         bz_PlayerSpawnEventData_V1 *playerData = (bz_PlayerSpawnEventData_V1*)eventData;
+        FlagManager *flagManager = arenaOf(playerData->playerID);
+        if (!flagManager) return;
+        grid.update(playerData->playerID, playerData->state.pos[0], playerData->state.pos[1]);
         const char *shouldHave = flagManager->getAssignedFlag(playerData->playerID);
         if (shouldHave)
         {
+            gives.spawned(playerData->playerID, bz_getCurrentTime());
             flagManager->givePlayerFlag(playerData->playerID, shouldHave);
             bz_sendTextMessagef(BZ_SERVER, playerData->playerID, "Spawned with %s", shouldHave);
 #ifdef PLAYSOUNDS
@@ -1057,34 +4789,68 @@ void GunGame::Event ( bz_EventData *eventData )
         {
             if (0 == strncmp(joinData->record->ipAddress.c_str(), debuggerIP, strlen(debuggerIP)))
             {
-                flagManager->debuggerID = joinData->playerID;
-                bz_sendTextMessagef(BZ_SERVER, flagManager->debuggerID, "Welcome debug overlord");
+                debuggerID = joinData->playerID;
+                for (int a = 0; a < MAXARENAS; ++a)
+                {
+                    if (arenas[a]) arenas[a]->debuggerID = debuggerID;
+                }
+                trace.chatDest = debuggerID;
+                bz_sendTextMessagef(BZ_SERVER, debuggerID, "Welcome debug overlord");
             }
         }
-         
-        if (flagManager->addPlayer(joinData))
+
+        if ((joinData->playerID < 0) || (joinData->playerID >= MAXPLAYERS)) return;
+        stateDirty = true;
+        cheatWatch.reset(joinData->playerID);
+        shotGuard.reset(joinData->playerID);
+        gives.parted(joinData->playerID);
+        lastCommand[joinData->playerID] = -COMMANDCOOLDOWN;
+        cooldownWarned[joinData->playerID] = false;
+        scoreboard.touch(bz_getPlayerCallsign(joinData->playerID));
+        if (!resumes.empty() && (bz_getCurrentTime() > resumeUntil)) resumes.clear();
+        int arena = pickArena(joinData);
+        playerArena[joinData->playerID] = arena;
+        arenas[arena]->addPlayer(joinData);
+        ResumesType::iterator r = resumeFor(joinData);
+        if (r != resumes.end())
         {
-            savedShotMismatch = bz_getShotMismatch();
-            bz_setShotMismatch(false);
-            Register(bz_ePlayerSpawnEvent);
-            Register(bz_ePlayerDieEvent);
-            Register(bz_eFlagDroppedEvent);
-            Register(bz_eShotFiredEvent);
-            Register(bz_eTickEvent);
+            arenas[arena]->resume(joinData->playerID, r->second.flag, r->second.matchStart);
+            resumes.erase(r);
+        }
+        if (FlagManager::sharded)
+        {
+            bz_sendTextMessagef(BZ_SERVER, joinData->playerID, "You are playing in arena %d", arena + 1);
         }
     }
 
     else if (eventData->eventType == bz_ePlayerPartEvent)
     {
         bz_PlayerJoinPartEventData_V1 *partData = (bz_PlayerJoinPartEventData_V1*)eventData;
-        if (flagManager->removePlayer(partData))
+        FlagManager *flagManager = arenaOf(partData->playerID);
+        if (flagManager)
         {
-            bz_setShotMismatch(savedShotMismatch);
-            Remove(bz_ePlayerSpawnEvent);
-            Remove(bz_ePlayerDieEvent);
-            Remove(bz_eFlagDroppedEvent);
-            Remove(bz_eShotFiredEvent);
-            Remove(bz_eTickEvent);
+            flagManager->removePlayer(partData);
+            grid.remove(partData->playerID);
+            playerArena[partData->playerID] = -1;
+            stateDirty = true;
+        }
+        // nothing of theirs carries over to whoever gets the slot next
+        if ((partData->playerID >= 0) && (partData->playerID < MAXPLAYERS))
+        {
+            cheatWatch.reset(partData->playerID);
+            shotGuard.reset(partData->playerID);
+            gives.parted(partData->playerID);
+            lastCommand[partData->playerID] = -COMMANDCOOLDOWN;
+            cooldownWarned[partData->playerID] = false;
+            if (partData->playerID == debuggerID)
+            {
+                debuggerID = BZ_ALLUSERS;
+                for (int a = 0; a < MAXARENAS; ++a)
+                {
+                    if (arenas[a]) arenas[a]->debuggerID = debuggerID;
+                }
+                trace.chatDest = debuggerID;
+            }
         }
     }
 }
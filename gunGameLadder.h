@@ -0,0 +1,202 @@
+/*
+Copyright (c) 2013, Dan Ryder
+All rights reserved.
+
+This package is free software;  you can redistribute it and/or
+modify it under the terms of the license found in the file
+named COPYING that should have accompanied this file.
+
+THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+gunGameLadder.h
+the flag ladder - which flags GunGame can give, how many players each
+needs, and how a player moves up and down among the enabled ones
+
+no server calls here, so the tools (ggsim, ggmapcheck) can use the
+same ladder as the plugin without building the plugin itself
+*/
+
+#ifndef _GUNGAME_LADDER_H_
+#define _GUNGAME_LADDER_H_
+
+#include <stddef.h>
+#include <map>
+
+#define CHEATPENALTY 3
+#define SUICIDEPENALTY 1
+
+// ORDERED LIST OF ALL THE FLAGS WE MIGHT USE
+// along with the #players required to enable them
+// and how fast they reload relative to a plain tank
+// (with the BZDB variable the server uses for that, if any)
+typedef struct {
+    const char *flagName;
+    size_t playersRequired;
+    float reloadRate;
+    const char *reloadRateVar;
+} FlagOption;
+
+static FlagOption possibleFlags[] = {
+        {"L", 2, 0.5f, "_laserAdRate"},
+        {"GM", 2, 1.0f, NULL},
+        {"SW", 3, 1.0f, NULL},
+        {"CL", 3, 1.0f, NULL},
+        {"F", 2, 2.0f, "_rFireAdRate"},
+        {"IB", 3, 1.0f, NULL},
+        {"A", 2, 1.0f, NULL},
+        {"MG", 2, 10.0f, "_mGunAdRate"},
+        {"ST", 2, 1.0f, NULL},
+        {"T", 2, 1.0f, NULL},
+        {"SB", 2, 1.0f, NULL},
+        {"V", 2, 1.0f, NULL},
+        {"BU", 3, 1.0f, NULL},
+        {"WG", 3, 1.0f, NULL},
+        {"QT", 2, 1.0f, NULL},
+        {"M", 4, 1.0f, NULL},
+        {"B", 4, 1.0f, NULL},
+        {"O", 4, 1.0f, NULL},
+        {"RT", 5, 1.0f, NULL},
+        {"LT", 5, 1.0f, NULL},
+        {"WA", 3, 1.0f, NULL},
+        {"JM", 4, 1.0f, NULL},
+        {"NJ", 4, 1.0f, NULL},
+        {"RC", 3, 1.0f, NULL},
+        {"SR", 2, 1.0f, NULL},
+        {NULL, 0, 0.0f, NULL}
+};
+
+// which flags are in play for a player count, and how to move up and
+// down among them
+class FlagLadder
+{
+protected:
+    typedef std::map<size_t, int> FlagLevelsType;
+
+    FlagLevelsType flagLevels;       // flag levels of all enabled flags (by flag#)
+
+    size_t numTotalFlags;        // #flags that could be enabled
+    size_t numEnabledFlags;      // #flags actually enabled
+    size_t minPlayers;           // min players for a game
+    int firstFlag;               // first flag enabled
+    int lastFlag;                // last flag enabled
+
+public:
+    size_t numPlayers;
+
+    FlagLadder()
+         : numEnabledFlags(0),
+           minPlayers(0),
+           firstFlag(-1),
+           lastFlag(-1),
+           numPlayers(0)
+    {
+        // count all flags, determine min #Players required
+        numTotalFlags = 0;
+        FlagOption *f = &possibleFlags[0];
+        while (f && f->flagName)
+        {
+            numTotalFlags++;
+            if (!minPlayers || (f->playersRequired < minPlayers))
+                minPlayers = f->playersRequired;
+            f++;
+        }
+    }
+
+    // if #flags enabled changes (as players come and go), update info about
+    // enabled flags
+    void recalcFlags()
+    {
+        firstFlag = -1;
+        lastFlag = -1;
+        flagLevels.clear();
+        numEnabledFlags = 0;
+        for (size_t f = 0; f < numTotalFlags; ++f)
+        {
+            if (possibleFlags[f].playersRequired <= numPlayers)
+            {
+                if (firstFlag < 0) firstFlag = f;
+                lastFlag = f;
+                numEnabledFlags++;
+                flagLevels[f] = numEnabledFlags;
+            }
+        }
+    }
+
+    // flag progression
+    int getNextFlag(int oldFlag, int &delta, int count=1)
+    {
+        int c = 0;
+        delta = 0;
+        if (oldFlag >= lastFlag) return lastFlag;
+        for (int f = oldFlag+1; f < numTotalFlags; ++f)
+        {
+            if (possibleFlags[f].playersRequired <= numPlayers)
+            {
+                delta += 1;
+                if ((++c==count) || (f == lastFlag))
+                {
+                    return f;
+                }
+            }
+        }
+        return -1;
+    }
+
+    // flag regression
+    int getPrevFlag(int oldFlag, int &delta, int count=1)
+    {
+        int c = 0;
+        delta = 0;
+        if (oldFlag <= firstFlag) return firstFlag;
+        for (int f = oldFlag-1; f >= 0; --f)
+        {
+            if (possibleFlags[f].playersRequired <= numPlayers)
+            {
+                delta += 1;
+                if ((++c==count) || (f == firstFlag))
+                {
+                    return f;
+                }
+            }
+        }
+        return -1;
+    }
+
+    // sometimes we don't care how many we've traversed
+    int getNextFlag(int oldFlag, int count=1) {
+        int foo = 0;
+        return getNextFlag(oldFlag, foo, count);
+    }
+    int getPrevFlag(int oldFlag, int count=1) {
+        int foo = 0;
+        return getPrevFlag(oldFlag, foo, count);
+    }
+
+    int numPlayersNeeded()
+    {
+        return (minPlayers - numPlayers);
+    }
+
+    bool gameOn()
+    {
+        return (numPlayersNeeded() <= 0);
+    }
+
+    // level (1 = first) of an enabled flag, 0 if not enabled
+    int flagLevel(int flag) const
+    {
+        FlagLevelsType::const_iterator i = flagLevels.find(flag);
+        return (i == flagLevels.end()) ? 0 : i->second;
+    }
+
+    int getFirstFlag() const { return firstFlag; }
+    int getLastFlag() const { return lastFlag; }
+    size_t getNumEnabledFlags() const { return numEnabledFlags; }
+    size_t getNumTotalFlags() const { return numTotalFlags; }
+};
+
+#endif
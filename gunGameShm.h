@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2013, Dan Ryder
+All rights reserved.
+
+This package is free software;  you can redistribute it and/or
+modify it under the terms of the license found in the file
+named COPYING that should have accompanied this file.
+
+THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+gunGameShm.h
+layout of the live match state gunGame.cpp publishes in POSIX shared
+memory (shm_open name in _ggShmName, "/gunGame.<port>" by default)
+
+one writer (the plugin), any number of readers, no locks: "seq" is a
+seqlock.  the plugin makes it odd, writes, then makes it even again.
+a reader copies the whole block and keeps it only if seq was the same
+even number before and after - see tools/ggshm/ggShmReader.h
+*/
+
+#ifndef _GUNGAME_SHM_H_
+#define _GUNGAME_SHM_H_
+
+#include <stdint.h>
+
+#define GGSHM_MAGIC       0x48534747   /* "GGSH" */
+#define GGSHM_VERSION     1
+#define GGSHM_MAXPLAYERS  256
+#define GGSHM_MAXARENAS   8
+#define GGSHM_MAXFLAGS    32
+#define GGSHM_MAXLEADERS  8
+#define GGSHM_MAXWINNERS  64
+#define GGSHM_CALLSIGNLEN 32
+#define GGSHM_FLAGLEN     4
+
+typedef struct
+{
+    int32_t playerID;
+    int32_t arena;
+    int32_t flag;                    /* ladder flag#, -1 if none yet */
+    int32_t level;                   /* 1 = first enabled flag, 0 if none */
+    int32_t wins;                    /* matches won on this server */
+    char callsign[GGSHM_CALLSIGNLEN];
+    char flagName[GGSHM_FLAGLEN];
+} GGShmPlayer;
+
+typedef struct
+{
+    int32_t active;
+    int32_t gameOn;
+    int32_t numPlayers;
+    int32_t numLevels;               /* enabled flags = kills to reach the last */
+    char ladder[GGSHM_MAXFLAGS][GGSHM_FLAGLEN];  /* enabled flags, by level-1 */
+    int32_t leaderLevel;             /* 0 if nobody is past the first flag */
+    int32_t numLeaders;
+    int32_t leaders[GGSHM_MAXLEADERS];           /* player IDs */
+    double matchStart;               /* unix time the current match began, 0 if none */
+} GGShmArena;
+
+typedef struct
+{
+    char callsign[GGSHM_CALLSIGNLEN];
+    int32_t wins;
+} GGShmWinner;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    volatile uint32_t seq;           /* odd while the plugin is writing */
+    uint32_t size;                   /* sizeof(GGShmState) */
+    double updated;                  /* unix time of the last write */
+    int32_t numPlayers;
+    int32_t numWinners;
+    GGShmArena arenas[GGSHM_MAXARENAS];
+    GGShmPlayer players[GGSHM_MAXPLAYERS];      /* first numPlayers are valid */
+    GGShmWinner winners[GGSHM_MAXWINNERS];      /* most wins first */
+} GGShmState;
+
+#endif
@@ -0,0 +1,290 @@
+/*
+Copyright (c) 2013, Dan Ryder
+All rights reserved.
+
+This package is free software;  you can redistribute it and/or
+modify it under the terms of the license found in the file
+named COPYING that should have accompanied this file.
+
+THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+bzfsAPI.h
+stand-in for the real bzfs plugin API, just the parts gunGame.cpp uses
+lets the plugin be built into the tools here and driven by fakebzfs.cpp
+signatures follow the BZFlag 2.4 API so the plugin builds unchanged
+*/
+
+#ifndef _BZFS_API_H_
+#define _BZFS_API_H_
+
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+
+#define BZ_API_VERSION 1
+
+#define BZ_SERVER       -2
+#define BZ_ALLUSERS     -1
+#define BZ_NULLUSER     -3
+
+typedef enum
+{
+    eNoTeam = -1,
+    eRogueTeam = 0,
+    eRedTeam,
+    eGreenTeam,
+    eBlueTeam,
+    ePurpleTeam,
+    eRabbitTeam,
+    eHunterTeam,
+    eObservers,
+    eAdministrators
+} bz_eTeamType;
+
+typedef enum
+{
+    bz_eNullEvent = 0,
+    bz_ePlayerJoinEvent,
+    bz_ePlayerPartEvent,
+    bz_ePlayerSpawnEvent,
+    bz_ePlayerDieEvent,
+    bz_eFlagDroppedEvent,
+    bz_eShotFiredEvent,
+    bz_eTickEvent,
+    bz_ePlayerUpdateEvent,
+    bz_eBZDBChange,
+    bz_eLastEvent
+} bz_eEventType;
+
+class bz_ApiString
+{
+public:
+    bz_ApiString() {}
+    bz_ApiString(const char *c) : str(c ? c : "") {}
+    bz_ApiString(const std::string &c) : str(c) {}
+
+    bz_ApiString& operator=(const char *c) { str = c ? c : ""; return *this; }
+    // the real one compares a std::string with the pointer - NULL is
+    // undefined behaviour there, so fail loudly here rather than hide it
+    bool operator==(const char *c) const { if (!c) abort(); return str == c; }
+    bool operator!=(const char *c) const { return !(*this == c); }
+    bool operator==(const bz_ApiString &c) const { return str == c.str; }
+
+    const char *c_str() const { return str.c_str(); }
+    size_t size() const { return str.size(); }
+
+private:
+    std::string str;
+};
+
+class bz_APIStringList
+{
+public:
+    size_t size() const { return list.size(); }
+    bz_ApiString get(unsigned int i) const { return list[i]; }
+    const bz_ApiString& operator[](int i) const { return list[i]; }
+    void push_back(const bz_ApiString &s) { list.push_back(s); }
+
+private:
+    std::vector<bz_ApiString> list;
+};
+
+typedef struct bz_PlayerUpdateState
+{
+    int status;
+    bool falling;
+    bool crossingWall;
+    bool inPhantomZone;
+    float pos[3];
+    float velocity[3];
+    float rotation;
+    float angVel;
+    int phydrv;
+} bz_PlayerUpdateState;
+
+class bz_BasePlayerRecord
+{
+public:
+    int version;
+    int playerID;
+    bz_ApiString callsign;
+    bz_eTeamType team;
+    bz_PlayerUpdateState lastKnownState;
+    bz_ApiString ipAddress;
+    bz_ApiString currentFlag;
+    int currentFlagID;
+    bool spawned;
+    bool verified;
+    bool admin;
+};
+
+class bz_EventData
+{
+public:
+    bz_EventData(bz_eEventType type = bz_eNullEvent) : version(1), eventType(type), eventTime(0.0) {}
+    virtual ~bz_EventData() {}
+
+    int version;
+    bz_eEventType eventType;
+    double eventTime;
+};
+
+class bz_PlayerJoinPartEventData_V1 : public bz_EventData
+{
+public:
+    int playerID;
+    bz_BasePlayerRecord *record;
+    bz_ApiString reason;
+};
+
+class bz_PlayerDieEventData_V1 : public bz_EventData
+{
+public:
+    int playerID;
+    bz_eTeamType team;
+    int killerID;
+    bz_eTeamType killerTeam;
+    bz_ApiString flagKilledWith;
+    int shotID;
+    bz_PlayerUpdateState state;
+};
+
+class bz_PlayerSpawnEventData_V1 : public bz_EventData
+{
+public:
+    int playerID;
+    bz_eTeamType team;
+    bz_PlayerUpdateState state;
+};
+
+class bz_FlagDroppedEventData_V1 : public bz_EventData
+{
+public:
+    int playerID;
+    int flagID;
+    const char *flagType;
+    float pos[3];
+};
+
+class bz_ShotFiredEventData_V1 : public bz_EventData
+{
+public:
+    bool changed;
+    float pos[3];
+    int playerID;
+    bz_ApiString type;
+};
+
+class bz_TickEventData_V1 : public bz_EventData
+{
+};
+
+class bz_BZDBChangeData_V1 : public bz_EventData
+{
+public:
+    bz_ApiString key;
+    bz_ApiString value;
+};
+
+class bz_PlayerUpdateEventData_V1 : public bz_EventData
+{
+public:
+    int playerID;
+    bz_PlayerUpdateState state;
+    bz_PlayerUpdateState lastState;
+    double stateTime;
+};
+
+class bz_Plugin
+{
+public:
+    bz_Plugin() : MaxWaitTime(-1.0f), Unloadable(true) {}
+    virtual ~bz_Plugin() {}
+
+    virtual const char* Name() = 0;
+    virtual void Init(const char *config) = 0;
+    virtual void Cleanup() { Flush(); }
+    virtual void Event(bz_EventData *) {}
+
+    float MaxWaitTime;
+    bool Unloadable;
+
+protected:
+    bool Register(bz_eEventType eventType);
+    bool Remove(bz_eEventType eventType);
+    void Flush();
+};
+
+class bz_CustomSlashCommandHandler
+{
+public:
+    virtual ~bz_CustomSlashCommandHandler() {}
+    virtual bool SlashCommand(int playerID, bz_ApiString command, bz_ApiString message, bz_APIStringList *params) = 0;
+};
+
+#define BZF_PLUGIN_CALL extern "C"
+
+#define BZ_PLUGIN(n) \
+    BZF_PLUGIN_CALL bz_Plugin* bz_GetPlugin(void) { return new n; } \
+    BZF_PLUGIN_CALL void bz_FreePlugin(bz_Plugin *plugin) { delete plugin; } \
+    BZF_PLUGIN_CALL int bz_GetMinVersion(void) { return BZ_API_VERSION; }
+
+BZF_PLUGIN_CALL bz_Plugin* bz_GetPlugin(void);
+BZF_PLUGIN_CALL void bz_FreePlugin(bz_Plugin *plugin);
+
+// players
+const char *bz_getPlayerCallsign(int playerID);
+bz_eTeamType bz_getPlayerTeam(int playerID);
+bz_BasePlayerRecord *bz_getPlayerByIndex(int playerID);
+bool bz_freePlayerRecord(bz_BasePlayerRecord *playerRecord);
+bool bz_getAdmin(int playerID);
+bool bz_hasPerm(int playerID, const char *perm);
+bool bz_killPlayer(int playerID, bool spawnOnBase, int killerID = -1, const char *flagID = NULL);
+
+// scores
+bool bz_setPlayerWins(int playerID, int wins);
+bool bz_setPlayerLosses(int playerID, int losses);
+bool bz_setPlayerTKs(int playerID, int tks);
+int bz_getPlayerWins(int playerID);
+int bz_getPlayerLosses(int playerID);
+
+// flags
+bool bz_givePlayerFlag(int playerID, const char *flagType, bool force);
+bool bz_removePlayerFlag(int playerID);
+bz_ApiString bz_getFlagName(int flagID);
+
+// messages
+bool bz_sendTextMessage(int from, int to, const char *message);
+bool bz_sendTextMessagef(int from, int to, const char *fmt, ...);
+bool bz_sendPlayCustomLocalSound(int playerID, const char *soundName);
+void bz_debugMessage(int level, const char *message);
+void bz_debugMessagef(int level, const char *fmt, ...);
+
+// server state
+double bz_getCurrentTime(void);
+bool bz_getShotMismatch(void);
+void bz_setShotMismatch(bool value);
+bz_ApiString bz_getPublicAddr(void);
+int bz_getPublicPort(void);
+
+// BZDB
+bool bz_BZDBItemExists(const char *variable);
+bool bz_getBZDBBool(const char *variable);
+int bz_getBZDBInt(const char *variable);
+double bz_getBZDBDouble(const char *variable);
+bz_ApiString bz_getBZDBString(const char *variable);
+bool bz_setBZDBBool(const char *variable, bool val, int perms = 0, bool persistent = false);
+bool bz_setBZDBInt(const char *variable, int val, int perms = 0, bool persistent = false);
+bool bz_setBZDBDouble(const char *variable, double val, int perms = 0, bool persistent = false);
+bool bz_setBZDBString(const char *variable, const char *val, int perms = 0, bool persistent = false);
+
+// slash commands
+bool bz_registerCustomSlashCommand(const char *command, bz_CustomSlashCommandHandler *handler);
+bool bz_removeCustomSlashCommand(const char *command);
+
+#endif
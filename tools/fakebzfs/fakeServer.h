@@ -0,0 +1,106 @@
+/*
+Copyright (c) 2013, Dan Ryder
+All rights reserved.
+
+This package is free software;  you can redistribute it and/or
+modify it under the terms of the license found in the file
+named COPYING that should have accompanied this file.
+
+THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+fakeServer.h
+driver side of the fake bzfs - tools use this to play the server
+everything runs on a virtual clock so runs are repeatable
+*/
+
+#ifndef _FAKE_SERVER_H_
+#define _FAKE_SERVER_H_
+
+#include "bzfsAPI.h"
+
+namespace fakebzfs
+{
+
+#define FAKE_MAXPLAYERS 255
+
+// log-spaced latency histogram (4 buckets per power of two, in ns)
+class LatencyHistogram
+{
+public:
+    enum { NUMBUCKETS = 256 };
+
+    LatencyHistogram() { clear(); }
+    void clear();
+    void add(double ns);
+    double percentile(double p) const;
+    unsigned long count() const { return samples; }
+    double max() const { return maxNs; }
+    double mean() const { return samples ? totalNs / samples : 0.0; }
+
+private:
+    unsigned long buckets[NUMBUCKETS];
+    unsigned long samples;
+    double totalNs;
+    double maxNs;
+};
+
+struct Stats
+{
+    unsigned long events[bz_eLastEvent];     // dispatched to the plugin
+    LatencyHistogram latency[bz_eLastEvent]; // plugin time per event
+    unsigned long giveAttempts;
+    unsigned long giveFailures;
+    unsigned long shotsChanged;              // shots the plugin rewrote
+    unsigned long messages;
+    unsigned long messageBytes;
+};
+
+// clock
+void setTime(double now);
+double now();
+
+// plugin
+bool loadPlugin(const char *config);
+void unloadPlugin();
+bool isRegistered(bz_eEventType eventType);
+bz_Plugin *loadedPlugin();             // NULL if none
+void setMeasureLatency(bool on);
+
+// map - copies of each flag type the world holds, and how long a dropped
+// flag takes to come back into play
+void setFlagCopies(const char *flagType, int copies);
+void setFlagRespawnDelay(double seconds);
+
+// players - all return false if the request made no sense for that player
+int join(const char *callsign, bz_eTeamType team = eRogueTeam, const char *ip = "127.0.0.1", bool verified = false);
+bool part(int playerID);
+bool spawn(int playerID);
+bool shoot(int playerID);
+bool kill(int victimID, int killerID);
+bool dropFlag(int playerID);
+bool staleDrop(int playerID, const char *flagType);   // drop event for a flag not held
+bool pickUp(int playerID, const char *flagType);      // drive over a free flag - no plugin event
+bool move(int playerID, float x, float y, float z);
+bool setAdmin(int playerID, bool admin);
+void tick();
+bool slash(int playerID, const char *command, const char *args = "");
+
+bool isConnected(int playerID);
+bool isSpawned(int playerID);
+const char *heldFlag(int playerID);   // "" if none
+int wins(int playerID);
+int numConnected();
+
+// chat from the plugin - NULL (default) just counts it
+void setMessageSink(void (*sink)(int from, int to, const char *message));
+
+Stats &stats();
+void resetStats();
+
+}
+
+#endif
@@ -0,0 +1,827 @@
+/*
+Copyright (c) 2013, Dan Ryder
+All rights reserved.
+
+This package is free software;  you can redistribute it and/or
+modify it under the terms of the license found in the file
+named COPYING that should have accompanied this file.
+
+THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+fakebzfs.cpp
+just enough of bzfs to host gunGame.cpp in-process
+flags are a fixed inventory like a real map: a give fails when no copy
+of that flag is free, and a dropped flag is out of play for a while
+*/
+
+#include "fakeServer.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+namespace fakebzfs
+{
+
+struct Player
+{
+    bool connected;
+    bool spawned;
+    bool verified;               // registered callsign, password checked
+    bool admin;
+    string callsign;
+    string ip;
+    bz_eTeamType team;
+    int flagID;                  // flag copy held, -1 if none
+    int wins;
+    int losses;
+    int tks;
+    bz_PlayerUpdateState state;
+};
+
+struct FlagCopy
+{
+    FlagCopy(const string &t="") : type(t), holder(-1) {}
+    string type;
+    int holder;
+};
+
+// copies of one flag type that are free, or on their way back
+struct FlagPool
+{
+    deque<int> free;
+    deque<pair<double, int> > respawning;
+};
+
+// long names, as the server reports them in player records
+struct FlagNames
+{
+    const char *abbrev;
+    const char *name;
+};
+
+static FlagNames flagNames[] = {
+    {"L", "Laser (+L)"},
+    {"GM", "Guided Missile (+GM)"},
+    {"SW", "Shock Wave (+SW)"},
+    {"CL", "Cloaking (+CL)"},
+    {"F", "Rapid Fire (+F)"},
+    {"IB", "Invisible Bullet (+IB)"},
+    {"A", "Agility (+A)"},
+    {"MG", "Machine Gun (+MG)"},
+    {"ST", "Stealth (+ST)"},
+    {"T", "Tiny (+T)"},
+    {"SB", "Super Bullet (+SB)"},
+    {"V", "High Speed (+V)"},
+    {"OO", "Oscillation Overthruster (+OO)"},
+    {"BU", "Burrow (+BU)"},
+    {"WG", "Wings (+WG)"},
+    {"QT", "Quick Turn (+QT)"},
+    {"M", "Momentum (-M)"},
+    {"B", "Blindness (-B)"},
+    {"O", "Obesity (-O)"},
+    {"RT", "Right Turn Only (-RT)"},
+    {"LT", "Left Turn Only (-LT)"},
+    {"WA", "Wide Angle (-WA)"},
+    {"JM", "Jamming (-JM)"},
+    {"NJ", "No Jumping (-NJ)"},
+    {"RC", "Reverse Controls (-RC)"},
+    {"SR", "SteamRoller (+SR)"},
+    {"PZ", "Phantom Zone (+PZ)"},
+    {NULL, NULL}
+};
+
+static Player players[FAKE_MAXPLAYERS];
+static vector<FlagCopy> flags;
+static map<string, FlagPool> pools;
+static double clockNow = 0.0;
+static double respawnDelay = 0.0;
+
+static bz_Plugin *plugin = NULL;
+static bool registered[bz_eLastEvent];
+static bool measureLatency = true;
+static map<string, string> bzdb;
+static map<string, bz_CustomSlashCommandHandler *> commands;
+static bool shotMismatch = true;
+static void (*messageSink)(int, int, const char *) = NULL;
+static Stats theStats;
+
+static double monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bool validPlayer(int playerID)
+{
+    return (playerID >= 0) && (playerID < FAKE_MAXPLAYERS) && players[playerID].connected;
+}
+
+static const char *longFlagName(const string &abbrev)
+{
+    for (FlagNames *f = flagNames; f->abbrev; ++f)
+    {
+        if (abbrev == f->abbrev) return f->name;
+    }
+    return abbrev.c_str();
+}
+
+static void dispatch(bz_EventData &eventData)
+{
+    eventData.eventTime = clockNow;
+    if (!plugin || !registered[eventData.eventType]) return;
+
+    theStats.events[eventData.eventType]++;
+    if (!measureLatency)
+    {
+        plugin->Event(&eventData);
+        return;
+    }
+    double start = monotonicNs();
+    plugin->Event(&eventData);
+    theStats.latency[eventData.eventType].add(monotonicNs() - start);
+}
+
+// put a held flag back in the pool - no event
+static int releaseFlag(int playerID)
+{
+    int flagID = players[playerID].flagID;
+    if (flagID < 0) return -1;
+    flags[flagID].holder = -1;
+    pools[flags[flagID].type].respawning.push_back(make_pair(clockNow + respawnDelay, flagID));
+    players[playerID].flagID = -1;
+    return flagID;
+}
+
+static void dropWithEvent(int playerID)
+{
+    int flagID = releaseFlag(playerID);
+    if (flagID < 0) return;
+
+    bz_FlagDroppedEventData_V1 dropData;
+    dropData.eventType = bz_eFlagDroppedEvent;
+    dropData.playerID = playerID;
+    dropData.flagID = flagID;
+    dropData.flagType = flags[flagID].type.c_str();
+    memcpy(dropData.pos, players[playerID].state.pos, sizeof(dropData.pos));
+    dispatch(dropData);
+}
+
+static bz_BasePlayerRecord *makeRecord(int playerID)
+{
+    Player &p = players[playerID];
+    bz_BasePlayerRecord *pr = new bz_BasePlayerRecord;
+    pr->version = 1;
+    pr->playerID = playerID;
+    pr->callsign = p.callsign;
+    pr->team = p.team;
+    pr->lastKnownState = p.state;
+    pr->ipAddress = p.ip;
+    pr->currentFlag = (p.flagID >= 0) ? longFlagName(flags[p.flagID].type) : "";
+    pr->currentFlagID = p.flagID;
+    pr->spawned = p.spawned;
+    pr->verified = p.verified;
+    pr->admin = p.admin;
+    return pr;
+}
+
+void LatencyHistogram::clear()
+{
+    memset(buckets, 0, sizeof(buckets));
+    samples = 0;
+    totalNs = 0.0;
+    maxNs = 0.0;
+}
+
+void LatencyHistogram::add(double ns)
+{
+    int b = (ns < 1.0) ? 0 : (int)(log2(ns) * 4.0);
+    if (b >= NUMBUCKETS) b = NUMBUCKETS - 1;
+    buckets[b]++;
+    samples++;
+    totalNs += ns;
+    if (ns > maxNs) maxNs = ns;
+}
+
+// upper edge of the bucket holding the p'th percentile
+double LatencyHistogram::percentile(double p) const
+{
+    if (!samples) return 0.0;
+    unsigned long want = (unsigned long)ceil(samples * p / 100.0);
+    unsigned long seen = 0;
+    for (int b = 0; b < NUMBUCKETS; ++b)
+    {
+        seen += buckets[b];
+        if (seen >= want)
+        {
+            double edge = pow(2.0, (b + 1) / 4.0);
+            return (edge < maxNs) ? edge : maxNs;
+        }
+    }
+    return maxNs;
+}
+
+void setTime(double now)
+{
+    clockNow = now;
+}
+
+double now()
+{
+    return clockNow;
+}
+
+bool loadPlugin(const char *config)
+{
+    if (plugin) return false;
+    memset(registered, 0, sizeof(registered));
+    plugin = bz_GetPlugin();
+    plugin->Init(config);
+    return true;
+}
+
+void unloadPlugin()
+{
+    if (!plugin) return;
+    plugin->Cleanup();
+    bz_FreePlugin(plugin);
+    plugin = NULL;
+}
+
+bool isRegistered(bz_eEventType eventType)
+{
+    return registered[eventType];
+}
+
+bz_Plugin *loadedPlugin()
+{
+    return plugin;
+}
+
+void setMeasureLatency(bool on)
+{
+    measureLatency = on;
+}
+
+void setFlagCopies(const char *flagType, int copies)
+{
+    FlagPool &pool = pools[flagType];
+    for (int c = 0; c < copies; ++c)
+    {
+        pool.free.push_back(flags.size());
+        flags.push_back(FlagCopy(flagType));
+    }
+}
+
+void setFlagRespawnDelay(double seconds)
+{
+    respawnDelay = seconds;
+}
+
+int join(const char *callsign, bz_eTeamType team, const char *ip, bool verified)
+{
+    int playerID = 0;
+    while ((playerID < FAKE_MAXPLAYERS) && players[playerID].connected) playerID++;
+    if (playerID >= FAKE_MAXPLAYERS) return -1;
+
+    Player &p = players[playerID];
+    p.connected = true;
+    p.spawned = false;
+    p.verified = verified;
+    p.admin = false;
+    p.callsign = callsign;
+    p.ip = ip;
+    p.team = team;
+    p.flagID = -1;
+    p.wins = p.losses = p.tks = 0;
+    memset(&p.state, 0, sizeof(p.state));
+
+    bz_PlayerJoinPartEventData_V1 joinData;
+    joinData.eventType = bz_ePlayerJoinEvent;
+    joinData.playerID = playerID;
+    joinData.record = makeRecord(playerID);
+    dispatch(joinData);
+    delete joinData.record;
+    return playerID;
+}
+
+bool part(int playerID)
+{
+    if (!validPlayer(playerID)) return false;
+
+    bz_PlayerJoinPartEventData_V1 partData;
+    partData.eventType = bz_ePlayerPartEvent;
+    partData.playerID = playerID;
+    partData.record = makeRecord(playerID);
+    partData.reason = "left";
+    dispatch(partData);
+    delete partData.record;
+
+    releaseFlag(playerID);
+    players[playerID].connected = false;
+    players[playerID].spawned = false;
+    return true;
+}
+
+bool spawn(int playerID)
+{
+    if (!validPlayer(playerID) || players[playerID].spawned) return false;
+    players[playerID].spawned = true;
+
+    bz_PlayerSpawnEventData_V1 spawnData;
+    spawnData.eventType = bz_ePlayerSpawnEvent;
+    spawnData.playerID = playerID;
+    spawnData.team = players[playerID].team;
+    spawnData.state = players[playerID].state;
+    dispatch(spawnData);
+    return true;
+}
+
+// returns true if the shot is still live after the plugin saw it
+bool shoot(int playerID)
+{
+    if (!validPlayer(playerID) || !players[playerID].spawned) return false;
+    int flagID = players[playerID].flagID;
+
+    bz_ShotFiredEventData_V1 shotData;
+    shotData.eventType = bz_eShotFiredEvent;
+    shotData.changed = false;
+    shotData.playerID = playerID;
+    shotData.type = (flagID >= 0) ? flags[flagID].type.c_str() : "";
+    memcpy(shotData.pos, players[playerID].state.pos, sizeof(shotData.pos));
+    dispatch(shotData);
+
+    if (shotData.changed)
+    {
+        theStats.shotsChanged++;
+        return false;
+    }
+    return true;
+}
+
+// same order as bzfs: flag drops while still alive, then again once dead,
+// then the die event, then the killer's win is counted
+bool kill(int victimID, int killerID)
+{
+    if (!validPlayer(victimID) || !players[victimID].spawned) return false;
+    string killerFlag;
+    if (validPlayer(killerID) && (players[killerID].flagID >= 0))
+    {
+        killerFlag = flags[players[killerID].flagID].type;
+    }
+
+    dropWithEvent(victimID);
+    players[victimID].spawned = false;
+    dropWithEvent(victimID);
+    players[victimID].losses++;
+
+    bz_PlayerDieEventData_V1 dieData;
+    dieData.eventType = bz_ePlayerDieEvent;
+    dieData.playerID = victimID;
+    dieData.team = players[victimID].team;
+    dieData.killerID = killerID;
+    dieData.killerTeam = validPlayer(killerID) ? players[killerID].team : eNoTeam;
+    dieData.flagKilledWith = killerFlag.c_str();
+    dieData.shotID = 0;
+    dieData.state = players[victimID].state;
+    dispatch(dieData);
+
+    if ((killerID != victimID) && validPlayer(killerID))
+    {
+        players[killerID].wins++;
+    }
+    return true;
+}
+
+bool dropFlag(int playerID)
+{
+    if (!validPlayer(playerID) || (players[playerID].flagID < 0)) return false;
+    dropWithEvent(playerID);
+    return true;
+}
+
+// a drop the plugin hears about late - after a death or a swap, for
+// some flag of this type the player no longer holds.  nothing moves
+bool staleDrop(int playerID, const char *flagType)
+{
+    if (!validPlayer(playerID)) return false;
+    int flagID = -1;
+    for (size_t f = 0; f < flags.size(); ++f)
+    {
+        if ((flags[f].type == flagType) && (flags[f].holder != playerID))
+        {
+            flagID = f;
+            break;
+        }
+    }
+    bz_FlagDroppedEventData_V1 dropData;
+    dropData.eventType = bz_eFlagDroppedEvent;
+    dropData.playerID = playerID;
+    dropData.flagID = flagID;
+    dropData.flagType = flagType;
+    memcpy(dropData.pos, players[playerID].state.pos, sizeof(dropData.pos));
+    dispatch(dropData);
+    return true;
+}
+
+bool move(int playerID, float x, float y, float z)
+{
+    if (!validPlayer(playerID)) return false;
+    bz_PlayerUpdateEventData_V1 updateData;
+    updateData.eventType = bz_ePlayerUpdateEvent;
+    updateData.playerID = playerID;
+    updateData.lastState = players[playerID].state;
+    players[playerID].state.pos[0] = x;
+    players[playerID].state.pos[1] = y;
+    players[playerID].state.pos[2] = z;
+    updateData.state = players[playerID].state;
+    updateData.stateTime = clockNow;
+    dispatch(updateData);
+    return true;
+}
+
+bool pickUp(int playerID, const char *flagType)
+{
+    if (!validPlayer(playerID) || (players[playerID].flagID >= 0)) return false;
+    // not the plugin's give - keep it out of the give counts
+    unsigned long attempts = theStats.giveAttempts, failures = theStats.giveFailures;
+    bool ok = bz_givePlayerFlag(playerID, flagType, false);
+    theStats.giveAttempts = attempts;
+    theStats.giveFailures = failures;
+    return ok;
+}
+
+bool setAdmin(int playerID, bool admin)
+{
+    if (!validPlayer(playerID)) return false;
+    players[playerID].admin = admin;
+    return true;
+}
+
+void tick()
+{
+    bz_TickEventData_V1 tickData;
+    tickData.eventType = bz_eTickEvent;
+    dispatch(tickData);
+}
+
+bool slash(int playerID, const char *command, const char *args)
+{
+    map<string, bz_CustomSlashCommandHandler *>::iterator i = commands.find(command);
+    if (i == commands.end()) return false;
+
+    bz_APIStringList params;
+    string word;
+    for (const char *c = args; ; ++c)
+    {
+        if (!*c || (*c == ' '))
+        {
+            if (word.size()) params.push_back(word.c_str());
+            word.clear();
+            if (!*c) break;
+        }
+        else
+        {
+            word += *c;
+        }
+    }
+    return i->second->SlashCommand(playerID, command, args, &params);
+}
+
+bool isConnected(int playerID)
+{
+    return validPlayer(playerID);
+}
+
+bool isSpawned(int playerID)
+{
+    return validPlayer(playerID) && players[playerID].spawned;
+}
+
+const char *heldFlag(int playerID)
+{
+    if (!validPlayer(playerID) || (players[playerID].flagID < 0)) return "";
+    return flags[players[playerID].flagID].type.c_str();
+}
+
+int wins(int playerID)
+{
+    return validPlayer(playerID) ? players[playerID].wins : 0;
+}
+
+int numConnected()
+{
+    int n = 0;
+    for (int p = 0; p < FAKE_MAXPLAYERS; ++p)
+    {
+        if (players[p].connected) n++;
+    }
+    return n;
+}
+
+void setMessageSink(void (*sink)(int from, int to, const char *message))
+{
+    messageSink = sink;
+}
+
+Stats &stats()
+{
+    return theStats;
+}
+
+void resetStats()
+{
+    memset(theStats.events, 0, sizeof(theStats.events));
+    for (int e = 0; e < bz_eLastEvent; ++e) theStats.latency[e].clear();
+    theStats.giveAttempts = 0;
+    theStats.giveFailures = 0;
+    theStats.shotsChanged = 0;
+    theStats.messages = 0;
+    theStats.messageBytes = 0;
+}
+
+}
+
+using namespace fakebzfs;
+
+// the bzfs API, as seen by the plugin
+
+bool bz_Plugin::Register(bz_eEventType eventType)
+{
+    registered[eventType] = true;
+    return true;
+}
+
+bool bz_Plugin::Remove(bz_eEventType eventType)
+{
+    registered[eventType] = false;
+    return true;
+}
+
+void bz_Plugin::Flush()
+{
+    memset(registered, 0, sizeof(registered));
+}
+
+const char *bz_getPlayerCallsign(int playerID)
+{
+    return validPlayer(playerID) ? players[playerID].callsign.c_str() : NULL;
+}
+
+bz_eTeamType bz_getPlayerTeam(int playerID)
+{
+    return validPlayer(playerID) ? players[playerID].team : eNoTeam;
+}
+
+bz_BasePlayerRecord *bz_getPlayerByIndex(int playerID)
+{
+    return validPlayer(playerID) ? makeRecord(playerID) : NULL;
+}
+
+bool bz_freePlayerRecord(bz_BasePlayerRecord *playerRecord)
+{
+    delete playerRecord;
+    return true;
+}
+
+bool bz_getAdmin(int playerID)
+{
+    return validPlayer(playerID) && players[playerID].admin;
+}
+
+bool bz_hasPerm(int playerID, const char *)
+{
+    return bz_getAdmin(playerID);
+}
+
+bool bz_killPlayer(int playerID, bool, int killerID, const char *)
+{
+    return kill(playerID, killerID);
+}
+
+bool bz_setPlayerWins(int playerID, int wins)
+{
+    if (!validPlayer(playerID)) return false;
+    players[playerID].wins = wins;
+    return true;
+}
+
+bool bz_setPlayerLosses(int playerID, int losses)
+{
+    if (!validPlayer(playerID)) return false;
+    players[playerID].losses = losses;
+    return true;
+}
+
+bool bz_setPlayerTKs(int playerID, int tks)
+{
+    if (!validPlayer(playerID)) return false;
+    players[playerID].tks = tks;
+    return true;
+}
+
+int bz_getPlayerWins(int playerID)
+{
+    return validPlayer(playerID) ? players[playerID].wins : -1;
+}
+
+int bz_getPlayerLosses(int playerID)
+{
+    return validPlayer(playerID) ? players[playerID].losses : -1;
+}
+
+bool bz_givePlayerFlag(int playerID, const char *flagType, bool force)
+{
+    theStats.giveAttempts++;
+    map<string, FlagPool>::iterator i = pools.find(flagType ? flagType : "");
+    if (!validPlayer(playerID) || !players[playerID].spawned || (i == pools.end()))
+    {
+        theStats.giveFailures++;
+        return false;
+    }
+
+    FlagPool &pool = i->second;
+    while (pool.respawning.size() && (pool.respawning.front().first <= clockNow))
+    {
+        pool.free.push_back(pool.respawning.front().second);
+        pool.respawning.pop_front();
+    }
+    if (!pool.free.size() || ((players[playerID].flagID >= 0) && !force))
+    {
+        theStats.giveFailures++;
+        return false;
+    }
+
+    releaseFlag(playerID);
+    int flagID = pool.free.front();
+    pool.free.pop_front();
+    flags[flagID].holder = playerID;
+    players[playerID].flagID = flagID;
+    return true;
+}
+
+bool bz_removePlayerFlag(int playerID)
+{
+    if (!validPlayer(playerID)) return false;
+    dropWithEvent(playerID);
+    return true;
+}
+
+bz_ApiString bz_getFlagName(int flagID)
+{
+    if ((flagID < 0) || (flagID >= (int)flags.size())) return bz_ApiString("");
+    return bz_ApiString(flags[flagID].type);
+}
+
+bool bz_sendTextMessage(int from, int to, const char *message)
+{
+    theStats.messages++;
+    theStats.messageBytes += strlen(message);
+    if (messageSink) messageSink(from, to, message);
+    return true;
+}
+
+bool bz_sendTextMessagef(int from, int to, const char *fmt, ...)
+{
+    char message[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+    return bz_sendTextMessage(from, to, message);
+}
+
+bool bz_sendPlayCustomLocalSound(int, const char *)
+{
+    return true;
+}
+
+void bz_debugMessage(int, const char *message)
+{
+    if (messageSink) messageSink(BZ_SERVER, BZ_NULLUSER, message);
+}
+
+void bz_debugMessagef(int level, const char *fmt, ...)
+{
+    char message[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+    bz_debugMessage(level, message);
+}
+
+double bz_getCurrentTime(void)
+{
+    return clockNow;
+}
+
+bool bz_getShotMismatch(void)
+{
+    return shotMismatch;
+}
+
+void bz_setShotMismatch(bool value)
+{
+    shotMismatch = value;
+}
+
+bz_ApiString bz_getPublicAddr(void)
+{
+    return bz_ApiString("localhost");
+}
+
+int bz_getPublicPort(void)
+{
+    return 5154;
+}
+
+bool bz_BZDBItemExists(const char *variable)
+{
+    return bzdb.find(variable) != bzdb.end();
+}
+
+bool bz_getBZDBBool(const char *variable)
+{
+    map<string, string>::const_iterator i = bzdb.find(variable);
+    if (i == bzdb.end()) return false;
+    return (i->second == "true") || (atof(i->second.c_str()) != 0.0);
+}
+
+int bz_getBZDBInt(const char *variable)
+{
+    map<string, string>::const_iterator i = bzdb.find(variable);
+    return (i == bzdb.end()) ? 0 : atoi(i->second.c_str());
+}
+
+double bz_getBZDBDouble(const char *variable)
+{
+    map<string, string>::const_iterator i = bzdb.find(variable);
+    return (i == bzdb.end()) ? 0.0 : atof(i->second.c_str());
+}
+
+bz_ApiString bz_getBZDBString(const char *variable)
+{
+    map<string, string>::const_iterator i = bzdb.find(variable);
+    return (i == bzdb.end()) ? bz_ApiString("") : bz_ApiString(i->second);
+}
+
+// bzfs tells plugins about every change, whoever made it
+static bool setBZDB(const char *variable, const string &value)
+{
+    bzdb[variable] = value;
+    bz_BZDBChangeData_V1 changeData;
+    changeData.eventType = bz_eBZDBChange;
+    changeData.key = variable;
+    changeData.value = value;
+    dispatch(changeData);
+    return true;
+}
+
+bool bz_setBZDBBool(const char *variable, bool val, int, bool)
+{
+    return setBZDB(variable, val ? "1" : "0");
+}
+
+bool bz_setBZDBInt(const char *variable, int val, int, bool)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", val);
+    return setBZDB(variable, buf);
+}
+
+bool bz_setBZDBDouble(const char *variable, double val, int, bool)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.17g", val);
+    return setBZDB(variable, buf);
+}
+
+bool bz_setBZDBString(const char *variable, const char *val, int, bool)
+{
+    return setBZDB(variable, val ? val : "");
+}
+
+bool bz_registerCustomSlashCommand(const char *command, bz_CustomSlashCommandHandler *handler)
+{
+    commands[command] = handler;
+    return true;
+}
+
+bool bz_removeCustomSlashCommand(const char *command)
+{
+    return commands.erase(command) > 0;
+}
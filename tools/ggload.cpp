@@ -0,0 +1,392 @@
+/*
+Copyright (c) 2013, Dan Ryder
+All rights reserved.
+
+This package is free software;  you can redistribute it and/or
+modify it under the terms of the license found in the file
+named COPYING that should have accompanied this file.
+
+THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+ggload.cpp
+load generator - runs the plugin inside the fake bzfs with N simulated
+players that join, spawn, shoot, kill, suicide, drop-spam and leave
+the game runs on a virtual clock as fast as the plugin allows; what we
+measure is real (wall clock) time spent inside the plugin
+*/
+
+#include "fakeServer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct LoadOptions
+{
+    LoadOptions()
+        : players(12), seed(1), duration(600.0), tickRate(50.0),
+          fireRate(1.0), killChance(0.2), suicideRate(0.01),
+          dropRate(0.05), leaveRate(0.002), rejoinDelay(5.0),
+          updateRate(10.0), flagCopies(-1), flagRespawn(0.1),
+          reportEvery(60.0), freshNames(false), verbose(false) {}
+
+    int players;
+    unsigned long seed;
+    double duration;       // simulated seconds
+    double tickRate;       // server ticks per simulated second
+    double fireRate;       // shots per second, per player
+    double killChance;     // chance a live shot kills someone
+    double suicideRate;    // per second, per player
+    double dropRate;       // drop key presses per second, per player
+    double leaveRate;      // per second, per player
+    double rejoinDelay;    // mean seconds before a leaver comes back
+    double updateRate;     // position updates per second, per player
+    int flagCopies;        // copies of each flag in the map (-1: one per player)
+    double flagRespawn;    // seconds a dropped flag is out of play
+    double reportEvery;    // simulated seconds between progress lines
+    bool freshNames;       // leavers come back with a new callsign
+    bool verbose;          // print plugin chat
+    vector<string> bzdb;   // name=value set after the plugin loads
+};
+
+// xorshift64* - same stream on every platform for a given seed
+class Rng
+{
+public:
+    Rng(unsigned long long seed) : state(seed ? seed : 0x9E3779B97F4A7C15ULL) {}
+
+    unsigned long long next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ULL;
+    }
+
+    // uniform in [0, 1)
+    double uniform()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    bool chance(double p)
+    {
+        return uniform() < p;
+    }
+
+    int below(int n)
+    {
+        return (int)(uniform() * n);
+    }
+
+    double exponential(double mean)
+    {
+        return -mean * log(1.0 - uniform());
+    }
+
+private:
+    unsigned long long state;
+};
+
+// a simulated client
+struct SimPlayer
+{
+    SimPlayer() : id(-1), generation(0), rejoinAt(0.0), respawnAt(-1.0) {}
+    int id;                // server player ID, -1 while disconnected
+    int generation;        // bumped on each rejoin when using fresh names
+    double rejoinAt;
+    double respawnAt;      // -1 if not waiting to spawn
+    float pos[2];
+};
+
+static const char *ladderFlags[] = {
+    "L", "GM", "SW", "CL", "F", "IB", "A", "MG", "ST", "T", "SB", "V", "BU",
+    "WG", "QT", "M", "B", "O", "RT", "LT", "WA", "JM", "NJ", "RC", "SR", NULL
+};
+
+static const char *eventNames[bz_eLastEvent] = {
+    "null", "join", "part", "spawn", "die", "drop", "shot", "tick", "update", "bzdb"
+};
+
+static double wallSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long residentKB()
+{
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return -1;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = -1;
+    fclose(f);
+    return (resident < 0) ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static unsigned long totalEvents()
+{
+    unsigned long n = 0;
+    for (int e = 0; e < bz_eLastEvent; ++e) n += fakebzfs::stats().events[e];
+    return n;
+}
+
+static void printChat(int from, int to, const char *message)
+{
+    printf("[%9.2f] %3d -> %3d: %s\n", fakebzfs::now(), from, to, message);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n players       simulated players, 1-255 (12)\n"
+            "  -s seed          RNG seed (1)\n"
+            "  -d seconds       simulated run length (600)\n"
+            "  -t hz            server ticks per second (50)\n"
+            "  -f rate          shots per second per player (1.0)\n"
+            "  -k chance        chance a live shot kills (0.2)\n"
+            "  -S rate          suicides per second per player (0.01)\n"
+            "  -D rate          drop-key presses per second per player (0.05)\n"
+            "  -l rate          leaves per second per player (0.002)\n"
+            "  -j seconds       mean time before a leaver rejoins (5)\n"
+            "  -u rate          position updates per second per player (10)\n"
+            "  -c copies        copies of each flag in the map (one per player)\n"
+            "  -R seconds       time a dropped flag is out of play (0.1)\n"
+            "  -i seconds       simulated seconds between reports (60)\n"
+            "  -b name=value    set a BZDB variable after loading (repeatable)\n"
+            "  -F               leavers rejoin under a new callsign\n"
+            "  -v               print plugin chat\n",
+            prog);
+}
+
+static bool parseOptions(int argc, char **argv, LoadOptions &opt)
+{
+    int c;
+    while ((c = getopt(argc, argv, "n:s:d:t:f:k:S:D:l:j:u:c:R:i:b:Fvh")) != -1)
+    {
+        switch (c)
+        {
+            case 'n': opt.players = atoi(optarg); break;
+            case 's': opt.seed = strtoul(optarg, NULL, 0); break;
+            case 'd': opt.duration = atof(optarg); break;
+            case 't': opt.tickRate = atof(optarg); break;
+            case 'f': opt.fireRate = atof(optarg); break;
+            case 'k': opt.killChance = atof(optarg); break;
+            case 'S': opt.suicideRate = atof(optarg); break;
+            case 'D': opt.dropRate = atof(optarg); break;
+            case 'l': opt.leaveRate = atof(optarg); break;
+            case 'j': opt.rejoinDelay = atof(optarg); break;
+            case 'u': opt.updateRate = atof(optarg); break;
+            case 'c': opt.flagCopies = atoi(optarg); break;
+            case 'R': opt.flagRespawn = atof(optarg); break;
+            case 'i': opt.reportEvery = atof(optarg); break;
+            case 'b': opt.bzdb.push_back(optarg); break;
+            case 'F': opt.freshNames = true; break;
+            case 'v': opt.verbose = true; break;
+            default: return false;
+        }
+    }
+    if ((opt.players < 1) || (opt.players > FAKE_MAXPLAYERS) || (opt.tickRate <= 0.0))
+    {
+        return false;
+    }
+    if (opt.flagCopies < 0) opt.flagCopies = opt.players;
+    return true;
+}
+
+static void setup(const LoadOptions &opt)
+{
+    for (const char **f = ladderFlags; *f; ++f)
+    {
+        fakebzfs::setFlagCopies(*f, opt.flagCopies);
+    }
+    fakebzfs::setFlagRespawnDelay(opt.flagRespawn);
+    if (opt.verbose) fakebzfs::setMessageSink(printChat);
+
+    fakebzfs::loadPlugin("");
+    for (size_t i = 0; i < opt.bzdb.size(); ++i)
+    {
+        string setting = opt.bzdb[i];
+        size_t eq = setting.find('=');
+        if (eq == string::npos) continue;
+        bz_setBZDBString(setting.substr(0, eq).c_str(), setting.substr(eq + 1).c_str());
+    }
+}
+
+static void joinPlayer(SimPlayer &p, int slot, const LoadOptions &opt, Rng &rng)
+{
+    char callsign[32];
+    if (opt.freshNames)
+        snprintf(callsign, sizeof(callsign), "sim%03d.%d", slot, p.generation++);
+    else
+        snprintf(callsign, sizeof(callsign), "sim%03d", slot);
+    p.id = fakebzfs::join(callsign);
+    p.respawnAt = fakebzfs::now() + 0.5 + rng.uniform();
+    p.pos[0] = (float)(rng.uniform() * 800.0 - 400.0);
+    p.pos[1] = (float)(rng.uniform() * 800.0 - 400.0);
+}
+
+// pick a live player other than "self", or -1
+static int pickTarget(vector<SimPlayer> &sims, int self, Rng &rng)
+{
+    for (int tries = 0; tries < 8; ++tries)
+    {
+        int s = rng.below(sims.size());
+        if ((s != self) && (sims[s].id >= 0) && fakebzfs::isSpawned(sims[s].id))
+        {
+            return sims[s].id;
+        }
+    }
+    return -1;
+}
+
+// one simulated tick's worth of client behaviour for every player
+static void stepPlayers(vector<SimPlayer> &sims, const LoadOptions &opt, Rng &rng, double dt)
+{
+    double t = fakebzfs::now();
+    for (int s = 0; s < (int)sims.size(); ++s)
+    {
+        SimPlayer &p = sims[s];
+        if (p.id < 0)
+        {
+            if (t >= p.rejoinAt) joinPlayer(p, s, opt, rng);
+            continue;
+        }
+
+        if (!fakebzfs::isSpawned(p.id))
+        {
+            // died (maybe by the plugin's hand) - come back after a bit
+            if (p.respawnAt < 0.0) p.respawnAt = t + 1.0 + 2.0 * rng.uniform();
+            if (t >= p.respawnAt)
+            {
+                fakebzfs::spawn(p.id);
+                p.respawnAt = -1.0;
+            }
+            continue;
+        }
+
+        if (rng.chance(opt.updateRate * dt))
+        {
+            p.pos[0] += (float)(rng.uniform() * 20.0 - 10.0);
+            p.pos[1] += (float)(rng.uniform() * 20.0 - 10.0);
+            fakebzfs::move(p.id, p.pos[0], p.pos[1], 0.0f);
+        }
+        if (rng.chance(opt.fireRate * dt))
+        {
+            if (fakebzfs::shoot(p.id) && rng.chance(opt.killChance))
+            {
+                int victim = pickTarget(sims, s, rng);
+                if (victim >= 0) fakebzfs::kill(victim, p.id);
+            }
+        }
+        if (!fakebzfs::isSpawned(p.id)) continue;
+
+        if (rng.chance(opt.dropRate * dt))
+        {
+            fakebzfs::dropFlag(p.id);
+        }
+        if (rng.chance(opt.suicideRate * dt))
+        {
+            fakebzfs::kill(p.id, p.id);
+        }
+        else if (rng.chance(opt.leaveRate * dt))
+        {
+            fakebzfs::part(p.id);
+            p.id = -1;
+            p.rejoinAt = t + rng.exponential(opt.rejoinDelay);
+        }
+    }
+}
+
+static void printLatency()
+{
+    printf("\n%-7s %10s %9s %9s %9s %9s %9s %9s\n",
+           "event", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (int e = 1; e < bz_eLastEvent; ++e)
+    {
+        const fakebzfs::LatencyHistogram &h = fakebzfs::stats().latency[e];
+        if (!h.count()) continue;
+        printf("%-7s %10lu %8.0fn %8.0fn %8.0fn %8.0fn %8.0fn %8.0fn\n",
+               eventNames[e], h.count(), h.mean(),
+               h.percentile(50), h.percentile(90), h.percentile(99),
+               h.percentile(99.9), h.max());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    LoadOptions opt;
+    if (!parseOptions(argc, argv, opt))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    setup(opt);
+    Rng rng(opt.seed);
+    vector<SimPlayer> sims(opt.players);
+
+    double dt = 1.0 / opt.tickRate;
+    long startKB = residentKB();
+    double wallStart = wallSeconds();
+    double wallLast = wallStart;
+    unsigned long eventsLast = 0;
+    double nextReport = opt.reportEvery;
+
+    printf("%9s %7s %12s %12s %10s %10s %9s\n",
+           "sim-sec", "players", "events", "events/s", "gives", "give-fail", "rss-KB");
+    for (double t = 0.0; t < opt.duration; t += dt)
+    {
+        fakebzfs::setTime(t);
+        stepPlayers(sims, opt, rng, dt);
+        fakebzfs::tick();
+
+        if ((t + dt >= nextReport) || (t + dt >= opt.duration))
+        {
+            double wallNow = wallSeconds();
+            unsigned long events = totalEvents();
+            const fakebzfs::Stats &st = fakebzfs::stats();
+            printf("%9.0f %7d %12lu %12.0f %10lu %9.2f%% %9ld\n",
+                   t + dt, fakebzfs::numConnected(), events,
+                   (events - eventsLast) / (wallNow - wallLast),
+                   st.giveAttempts,
+                   st.giveAttempts ? 100.0 * st.giveFailures / st.giveAttempts : 0.0,
+                   residentKB());
+            fflush(stdout);
+            wallLast = wallNow;
+            eventsLast = events;
+            nextReport += opt.reportEvery;
+        }
+    }
+
+    double wallTotal = wallSeconds() - wallStart;
+    const fakebzfs::Stats &st = fakebzfs::stats();
+    unsigned long events = totalEvents();
+    long endKB = residentKB();
+
+    printLatency();
+    printf("\nplayers %d, seed %lu, %.0f simulated seconds in %.2f wall seconds\n",
+           opt.players, opt.seed, opt.duration, wallTotal);
+    printf("sustained: %.0f events/s (%lu events)\n", events / wallTotal, events);
+    printf("flag gives: %lu, failed %lu (%.2f%%)\n", st.giveAttempts, st.giveFailures,
+           st.giveAttempts ? 100.0 * st.giveFailures / st.giveAttempts : 0.0);
+    printf("shots rewritten by plugin: %lu\n", st.shotsChanged);
+    printf("chat: %lu messages, %lu bytes\n", st.messages, st.messageBytes);
+    printf("memory: %ld KB -> %ld KB resident (%+ld KB)\n", startKB, endKB, endKB - startKB);
+
+    fakebzfs::unloadPlugin();
+    return 0;
+}
@@ -0,0 +1,364 @@
+/*
+Copyright (c) 2013, Dan Ryder
+All rights reserved.
+
+This package is free software;  you can redistribute it and/or
+modify it under the terms of the license found in the file
+named COPYING that should have accompanied this file.
+
+THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+ggmapcheck.cpp
+preflight a .bzw for GunGame - count the flags the map puts in play
+against the ladder for a player count, report what is short and
+optionally print a flag hider block (like mapchanges.txt) to make up
+the difference
+
+counted: zone "zoneflag TYPE [n]" lines and options "+f TYPE{n}".
+a zone's "flag" line adds no flags, it only says where ones already
+in play may spawn.  zones inside a define count once per group that
+uses it.  "-f TYPE" in options is reported, since a banned flag can
+never be given.  the -z block is named clear of the map's own names
+
+the file is mmap'd and scanned once, a line at a time, without copying
+*/
+
+#include "../gunGameLadder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <set>
+#include <string>
+
+using namespace std;
+
+typedef map<string, long> FlagCountType;
+
+// a whitespace-separated word in the mapped file
+struct Token
+{
+    const char *p;
+    size_t len;
+
+    bool is(const char *word) const
+    {
+        return (strlen(word) == len) && (0 == strncasecmp(p, word, len));
+    }
+    string str() const { return string(p, len); }
+};
+
+static inline bool blank(char c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') || (c == '\f') || (c == '\v');
+}
+
+// words of one line, comments dropped
+static int tokenize(const char *line, const char *end, Token *tokens, int maxTokens)
+{
+    int n = 0;
+    const char *c = line;
+    while ((c < end) && (n < maxTokens))
+    {
+        while ((c < end) && blank(*c)) ++c;
+        if ((c >= end) || (*c == '#')) break;
+        tokens[n].p = c;
+        while ((c < end) && !blank(*c)) ++c;
+        tokens[n].len = c - tokens[n].p;
+        ++n;
+    }
+    return n;
+}
+
+static string flagKey(const char *p, size_t len)
+{
+    string key(p, len);
+    for (size_t i = 0; i < key.size(); ++i) key[i] = toupper((unsigned char)key[i]);
+    return key;
+}
+
+struct MapScan
+{
+    FlagCountType total;                 // flags the world will have
+    map<string, FlagCountType> defines;  // flags inside each define
+    set<string> banned;                  // -f in options
+    set<string> names;                   // object names, so ours don't clash
+    long lines;
+    int zones;
+    int flagOptions;
+    int groups;
+
+    MapScan() : lines(0), zones(0), flagOptions(0), groups(0) {}
+};
+
+static void scanMap(const char *data, size_t size, MapScan &scan)
+{
+    enum { OTHER, ZONE, OPTIONS, GROUP } block = OTHER;
+    string defineName;
+    Token tok[64];
+
+    const char *end = data + size;
+    for (const char *line = data; line < end; )
+    {
+        const char *eol = (const char *)memchr(line, '\n', end - line);
+        if (!eol) eol = end;
+        scan.lines++;
+        const char *start = line;
+        line = eol + 1;
+
+        // most lines of a big world are object geometry - skip them on
+        // the first letter (end enddef zone zoneflag options define group name)
+        while ((start < eol) && blank(*start)) ++start;
+        if (start == eol) continue;
+        char first = tolower((unsigned char)*start);
+        if ((block != OPTIONS) && !strchr("ezodgn", first)) continue;
+
+        // outside zones and options only the keyword and a name matter
+        int n = tokenize(start, eol, tok, ((block == ZONE) || (block == OPTIONS)) ? 64 : 2);
+        if (!n) continue;
+
+        FlagCountType &counts = defineName.size() ? scan.defines[defineName] : scan.total;
+
+        if (tok[0].is("name") && (n >= 2))
+        {
+            scan.names.insert(tok[1].str());
+        }
+        else if (tok[0].is("end"))
+        {
+            block = OTHER;
+        }
+        else if (tok[0].is("enddef"))
+        {
+            defineName.clear();
+            block = OTHER;
+        }
+        else if (block == ZONE)
+        {
+            if (tok[0].is("zoneflag") && (n >= 2))
+            {
+                counts[flagKey(tok[1].p, tok[1].len)] += (n >= 3) ? atol(tok[2].str().c_str()) : 1;
+            }
+        }
+        else if (block == OPTIONS)
+        {
+            for (int t = 0; t + 1 < n; ++t)
+            {
+                if (tok[t].is("+f"))
+                {
+                    // TYPE or TYPE{count}
+                    const char *brace = (const char *)memchr(tok[t + 1].p, '{', tok[t + 1].len);
+                    size_t len = brace ? (size_t)(brace - tok[t + 1].p) : tok[t + 1].len;
+                    counts[flagKey(tok[t + 1].p, len)] += brace ? atol(brace + 1) : 1;
+                    scan.flagOptions++;
+                }
+                else if (tok[t].is("-f"))
+                {
+                    scan.banned.insert(flagKey(tok[t + 1].p, tok[t + 1].len));
+                }
+            }
+        }
+        else if (block == GROUP)
+        {
+            // group parameters (shift, rotate...) don't change flag counts
+        }
+        else if (tok[0].is("zone"))
+        {
+            block = ZONE;
+            scan.zones++;
+        }
+        else if (tok[0].is("options"))
+        {
+            block = OPTIONS;
+        }
+        else if (tok[0].is("define") && (n >= 2))
+        {
+            defineName = tok[1].str();
+        }
+        else if (tok[0].is("group") && (n >= 2))
+        {
+            block = GROUP;
+            scan.groups++;
+            map<string, FlagCountType>::const_iterator d = scan.defines.find(tok[1].str());
+            if (d != scan.defines.end())
+            {
+                for (FlagCountType::const_iterator f = d->second.begin(); f != d->second.end(); ++f)
+                {
+                    counts[f->first] += f->second;
+                }
+            }
+        }
+    }
+}
+
+// "base", or "base2", "base3"... if the map already has that name
+static string unusedName(const set<string> &names, const char *base)
+{
+    string name = base;
+    for (int n = 2; names.count(name); ++n)
+    {
+        char numbered[64];
+        snprintf(numbered, sizeof(numbered), "%s%d", base, n);
+        name = numbered;
+    }
+    return name;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] map.bzw\n"
+            "  -p players   players the map must supply flags for (12)\n"
+            "  -z           print a flag hider block that makes up any shortfall\n"
+            "  -q           only print problems\n"
+            "exit status is 1 if any ladder flag is short or banned\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    int players = 12;
+    bool printBlock = false;
+    bool quiet = false;
+    int c;
+    while ((c = getopt(argc, argv, "p:zqh")) != -1)
+    {
+        switch (c)
+        {
+            case 'p': players = atoi(optarg); break;
+            case 'z': printBlock = true; break;
+            case 'q': quiet = true; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if ((optind != argc - 1) || (players < 1))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    const char *fileName = argv[optind];
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    int fd = open(fileName, O_RDONLY);
+    struct stat st;
+    if ((fd < 0) || (fstat(fd, &st) != 0))
+    {
+        perror(fileName);
+        return 2;
+    }
+    MapScan result;
+    if (st.st_size > 0)
+    {
+        void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (mem == MAP_FAILED)
+        {
+            perror(fileName);
+            return 2;
+        }
+        madvise(mem, st.st_size, MADV_SEQUENTIAL);
+        scanMap((const char *)mem, st.st_size, result);
+        munmap(mem, st.st_size);
+    }
+    close(fd);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+
+    // the ladder at this player count
+    FlagLadder ladder;
+    ladder.numPlayers = players;
+    ladder.recalcFlags();
+
+    if (!quiet)
+    {
+        printf("%s: %.1f MB, %ld lines in %.2f ms - %d zones, %d +f options, %d groups\n",
+               fileName, st.st_size / 1048576.0, result.lines, ms, result.zones, result.flagOptions, result.groups);
+        printf("%d players: %d flags on the ladder, %d of each needed\n\n",
+               players, (int)ladder.getNumEnabledFlags(), players);
+        printf("%-4s %6s %6s\n", "flag", "need", "have");
+    }
+
+    FlagCountType shortfall;
+    int problems = 0;
+    set<string> onLadder;
+    for (int f = 0; possibleFlags[f].flagName; ++f)
+    {
+        string flag = possibleFlags[f].flagName;
+        onLadder.insert(flag);
+        if (ladder.flagLevel(f) <= 0) continue;
+        long have = result.total.count(flag) ? result.total[flag] : 0;
+        bool banned = result.banned.count(flag) > 0;
+        const char *note = "";
+        if (banned)
+        {
+            note = "  BANNED by -f";
+            problems++;
+        }
+        else if (have < players)
+        {
+            note = "  SHORT";
+            shortfall[flag] = players - have;
+            problems++;
+        }
+        if (!quiet || *note)
+        {
+            printf("%-4s %6d %6ld%s\n", flag.c_str(), players, have, note);
+        }
+    }
+
+    if (!quiet)
+    {
+        string extra;
+        for (FlagCountType::const_iterator i = result.total.begin(); i != result.total.end(); ++i)
+        {
+            if (!onLadder.count(i->first))
+            {
+                char item[32];
+                snprintf(item, sizeof(item), " %s(%ld)", i->first.c_str(), i->second);
+                extra += item;
+            }
+        }
+        if (extra.size()) printf("\nnot on the ladder:%s\n", extra.c_str());
+        printf("\n%s\n", problems ? "map needs changes" : "map is ok");
+    }
+
+    if (printBlock && shortfall.size())
+    {
+        printf("\n"
+               "# GunGame flag hider - %d players\n"
+               "box\n"
+               "name %s\n"
+               "position -1 -1 600\n"
+               "rotation 0\n"
+               "size 2 2 .5\n"
+               "end\n"
+               "\n"
+               "zone\n"
+               "   name %s\n"
+               "   size 1.0 1.0 11\n"
+               "   pos -0.5 -0.5 601\n",
+               players, unusedName(result.names, "flaghider").c_str(),
+               unusedName(result.names, "flagzone").c_str());
+        // ladder order, like mapchanges.txt
+        for (int f = 0; possibleFlags[f].flagName; ++f)
+        {
+            FlagCountType::const_iterator s = shortfall.find(possibleFlags[f].flagName);
+            if (s != shortfall.end()) printf("   zoneflag %s %ld\n", s->first.c_str(), s->second);
+        }
+        printf("end\n");
+    }
+    return problems ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+/*
+Copyright (c) 2013, Dan Ryder
+All rights reserved.
+
+This package is free software;  you can redistribute it and/or
+modify it under the terms of the license found in the file
+named COPYING that should have accompanied this file.
+
+THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+ggShmReader.cpp
+*/
+
+#include "ggShmReader.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+GGShmReader::GGShmReader() : shared(NULL), numRetries(0)
+{
+}
+
+GGShmReader::~GGShmReader()
+{
+    close();
+}
+
+bool GGShmReader::open(const char *name)
+{
+    close();
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return false;
+    void *mem = mmap(NULL, sizeof(GGShmState), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) return false;
+
+    shared = (const GGShmState *)mem;
+    numRetries = 0;
+    if ((shared->magic != GGSHM_MAGIC) || (shared->version != GGSHM_VERSION) ||
+        (shared->size != sizeof(GGShmState)))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void GGShmReader::close()
+{
+    if (!shared) return;
+    munmap((void *)shared, sizeof(GGShmState));
+    shared = NULL;
+}
+
+bool GGShmReader::snapshot(GGShmState &out, int maxTries)
+{
+    if (!shared) return false;
+    for (int t = 0; t < maxTries; ++t)
+    {
+        unsigned int before = shared->seq;
+        __sync_synchronize();
+        if (!(before & 1))
+        {
+            memcpy(&out, (const void *)shared, sizeof(GGShmState));
+            __sync_synchronize();
+            if (shared->seq == before)
+            {
+                out.seq = before;
+                return true;
+            }
+        }
+        numRetries++;
+        sched_yield();
+    }
+    return false;
+}
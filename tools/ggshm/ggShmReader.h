@@ -0,0 +1,49 @@
+/*
+Copyright (c) 2013, Dan Ryder
+All rights reserved.
+
+This package is free software;  you can redistribute it and/or
+modify it under the terms of the license found in the file
+named COPYING that should have accompanied this file.
+
+THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+ggShmReader.h
+read-only access to the state a GunGame server publishes in shared
+memory.  readers never block the server - a snapshot is retried if the
+plugin was writing while it was copied
+*/
+
+#ifndef _GG_SHM_READER_H_
+#define _GG_SHM_READER_H_
+
+#include "../../gunGameShm.h"
+
+class GGShmReader
+{
+public:
+    GGShmReader();
+    ~GGShmReader();
+
+    // name as in _ggShmName, e.g. "/gunGame.5154"
+    bool open(const char *name);
+    void close();
+
+    // copy a consistent snapshot into "out"
+    // false if not open, not a GunGame segment, or the writer kept
+    // getting in the way for maxTries attempts
+    bool snapshot(GGShmState &out, int maxTries = 1000);
+
+    // snapshots that had to be retried since open()
+    unsigned long retries() const { return numRetries; }
+
+private:
+    const GGShmState *shared;
+    unsigned long numRetries;
+};
+
+#endif
@@ -0,0 +1,129 @@
+/*
+Copyright (c) 2013, Dan Ryder
+All rights reserved.
+
+This package is free software;  you can redistribute it and/or
+modify it under the terms of the license found in the file
+named COPYING that should have accompanied this file.
+
+THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+ggshmcat.cpp
+print what a GunGame server publishes in shared memory
+    ggshmcat [-w seconds] [name]     (name defaults to /gunGame.5154)
+*/
+
+#include "ggShmReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static double wallClock()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void print(const GGShmState &s)
+{
+    double now = wallClock();
+    printf("seq %u, updated %.1fs ago, %d players\n", s.seq, now - s.updated, s.numPlayers);
+
+    for (int a = 0; a < GGSHM_MAXARENAS; ++a)
+    {
+        const GGShmArena &arena = s.arenas[a];
+        if (!arena.active) continue;
+
+        printf("\narena %d: %d players, %s", a + 1, arena.numPlayers, arena.gameOn ? "playing" : "waiting");
+        if (arena.gameOn && (arena.matchStart > 0.0))
+        {
+            int secs = (int)(now - arena.matchStart);
+            printf(" for %d:%02d", secs / 60, secs % 60);
+        }
+        printf("\n  ladder (%d):", arena.numLevels);
+        for (int l = 0; (l < arena.numLevels) && (l < GGSHM_MAXFLAGS); ++l)
+        {
+            printf(" %s", arena.ladder[l]);
+        }
+        printf("\n");
+        if (arena.leaderLevel)
+        {
+            printf("  leading at level %d:", arena.leaderLevel);
+            for (int l = 0; l < arena.numLeaders; ++l)
+            {
+                for (int p = 0; p < s.numPlayers; ++p)
+                {
+                    if (s.players[p].playerID == arena.leaders[l]) printf(" %s", s.players[p].callsign);
+                }
+            }
+            printf("\n");
+        }
+        for (int p = 0; p < s.numPlayers; ++p)
+        {
+            const GGShmPlayer &pl = s.players[p];
+            if (pl.arena != a) continue;
+            printf("  %3d %-24s %-3s level %2d/%-2d  %d win%s\n",
+                   pl.playerID, pl.callsign, pl.flag >= 0 ? pl.flagName : "-",
+                   pl.level, arena.numLevels, pl.wins, pl.wins == 1 ? "" : "s");
+        }
+    }
+
+    if (s.numWinners)
+    {
+        printf("\nwinners:\n");
+        for (int w = 0; w < s.numWinners; ++w)
+        {
+            printf("  %4d  %s\n", s.winners[w].wins, s.winners[w].callsign);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double watch = 0.0;
+    int c;
+    while ((c = getopt(argc, argv, "w:h")) != -1)
+    {
+        if (c == 'w')
+        {
+            watch = atof(optarg);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-w seconds] [name]\n", argv[0]);
+            return 1;
+        }
+    }
+    const char *name = (optind < argc) ? argv[optind] : "/gunGame.5154";
+
+    GGShmReader reader;
+    if (!reader.open(name))
+    {
+        fprintf(stderr, "%s: no GunGame state published as %s\n", argv[0], name);
+        return 1;
+    }
+
+    GGShmState *state = new GGShmState;
+    do
+    {
+        if (!reader.snapshot(*state))
+        {
+            fprintf(stderr, "%s: no consistent snapshot\n", argv[0]);
+            return 1;
+        }
+        if (watch > 0.0) printf("\033[H\033[2J");
+        print(*state);
+        fflush(stdout);
+        if (watch > 0.0) usleep((useconds_t)(watch * 1e6));
+    } while (watch > 0.0);
+
+    delete state;
+    return 0;
+}
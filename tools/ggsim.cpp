@@ -0,0 +1,518 @@
+/*
+Copyright (c) 2013, Dan Ryder
+All rights reserved.
+
+This package is free software;  you can redistribute it and/or
+modify it under the terms of the license found in the file
+named COPYING that should have accompanied this file.
+
+THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+ggsim.cpp
+Monte Carlo ladder simulator - plays many matches per configuration
+(player count, suicide penalty, cheat penalty) to show how long games
+run and where players get stuck
+
+the ladder comes straight from the plugin's FlagLadder, so
+playersRequired changes in gunGameLadder.h are picked up on rebuild
+
+each flag gets a kill rate (kills per minute while holding it) and a
+suicide rate.  matches are split into jobs by (configuration, seed
+chunk); every job has its own RNG stream and results are merged in job
+order, so output does not depend on the number of threads
+*/
+
+#include "../gunGameLadder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+#define SIM_MAXFLAGS 32
+#define SIM_MAXPLAYERS 64
+#define SIM_BINSEC 10                  // match length histogram bin
+#define SIM_MAXBINS 2160               // 6 hours of bins
+
+// rough guesses at kills per minute with each flag - override with -k
+struct FlagRate
+{
+    const char *flagName;
+    double killsPerMin;
+    double suicidesPerMin;
+};
+
+static FlagRate defaultRates[] = {
+    {"L", 1.6, 0.02},  {"GM", 1.4, 0.02}, {"SW", 1.5, 0.10}, {"CL", 1.1, 0.02},
+    {"F", 1.4, 0.02},  {"IB", 1.2, 0.02}, {"A", 1.0, 0.02},  {"MG", 1.3, 0.02},
+    {"ST", 1.0, 0.02}, {"T", 1.0, 0.02},  {"SB", 1.5, 0.02}, {"V", 1.0, 0.02},
+    {"BU", 0.8, 0.05}, {"WG", 1.0, 0.03}, {"QT", 1.0, 0.02}, {"M", 0.7, 0.03},
+    {"B", 0.5, 0.03},  {"O", 0.7, 0.03},  {"RT", 0.5, 0.05}, {"LT", 0.5, 0.05},
+    {"WA", 0.6, 0.03}, {"JM", 0.8, 0.02}, {"NJ", 0.8, 0.02}, {"RC", 0.5, 0.08},
+    {"SR", 0.4, 0.02}, {NULL, 0.0, 0.0}
+};
+
+struct SimOptions
+{
+    SimOptions()
+        : minPlayers(2), maxPlayers(12), matches(100000), seed(1),
+          threads(0), chunk(2000), stuckSec(120.0), cheatChance(0.0),
+          maxMatchSec(SIM_BINSEC * SIM_MAXBINS), verbose(false) {}
+
+    int minPlayers;
+    int maxPlayers;
+    long matches;              // per configuration
+    unsigned long seed;
+    int threads;               // 0 = one per CPU
+    long chunk;                // matches per job
+    double stuckSec;           // this long at one flag counts as stuck
+    double cheatChance;        // chance a kill is flagged as a drop-shoot cheat
+    double maxMatchSec;        // give up on matches longer than this
+    bool verbose;              // per-flag breakdown
+    vector<int> suicidePenalties;
+    vector<int> cheatPenalties;
+    double killsPerMin[SIM_MAXFLAGS];
+    double suicidesPerMin[SIM_MAXFLAGS];
+};
+
+// one point in the sweep, with the ladder tables built from FlagLadder
+struct SimConfig
+{
+    int players;
+    int suicidePenalty;
+    int cheatPenalty;
+    int firstFlag;
+    int lastFlag;
+    int numLevels;
+    int level[SIM_MAXFLAGS];          // 1-based level by flag#, 0 if disabled
+    int next[SIM_MAXFLAGS];
+    int afterSuicide[SIM_MAXFLAGS];
+    int afterCheat[SIM_MAXFLAGS];
+    double killRate[SIM_MAXFLAGS];    // per second
+    double suicideRate[SIM_MAXFLAGS]; // per second
+};
+
+struct SimResult
+{
+    SimResult() { memset(this, 0, sizeof(*this)); }
+
+    void merge(const SimResult &r)
+    {
+        matches += r.matches;
+        unfinished += r.unfinished;
+        totalSec += r.totalSec;
+        for (int b = 0; b < SIM_MAXBINS; ++b) lengthBins[b] += r.lengthBins[b];
+        for (int f = 0; f < SIM_MAXFLAGS; ++f)
+        {
+            secAtFlag[f] += r.secAtFlag[f];
+            visits[f] += r.visits[f];
+            stuck[f] += r.stuck[f];
+        }
+    }
+
+    long matches;
+    long unfinished;
+    double totalSec;
+    long lengthBins[SIM_MAXBINS];
+    double secAtFlag[SIM_MAXFLAGS];   // player-seconds holding each flag
+    long visits[SIM_MAXFLAGS];        // times a player got each flag
+    long stuck[SIM_MAXFLAGS];         // visits that lasted stuckSec or more
+};
+
+struct SimJob
+{
+    int config;
+    long matches;
+    unsigned long long seed;
+    SimResult result;
+};
+
+// xorshift64*, seeded per job so results don't depend on thread count
+class Rng
+{
+public:
+    Rng(unsigned long long seed) : state(seed ? seed : 0x9E3779B97F4A7C15ULL) {}
+
+    unsigned long long next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ULL;
+    }
+
+    double uniform()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    unsigned long long state;
+};
+
+static unsigned long long mixSeed(unsigned long long seed, unsigned long long a, unsigned long long b)
+{
+    unsigned long long z = seed + 0x9E3779B97F4A7C15ULL * (a * 1000003ULL + b + 1);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static SimOptions options;
+static vector<SimConfig> configs;
+static vector<SimJob> jobs;
+static long nextJob = 0;
+
+static void buildConfig(SimConfig &c, int players, int suicidePenalty, int cheatPenalty)
+{
+    FlagLadder ladder;
+    ladder.numPlayers = players;
+    ladder.recalcFlags();
+
+    memset(&c, 0, sizeof(c));
+    c.players = players;
+    c.suicidePenalty = suicidePenalty;
+    c.cheatPenalty = cheatPenalty;
+    c.firstFlag = ladder.getFirstFlag();
+    c.lastFlag = ladder.getLastFlag();
+    c.numLevels = ladder.getNumEnabledFlags();
+    for (int f = 0; f < (int)ladder.getNumTotalFlags() && f < SIM_MAXFLAGS; ++f)
+    {
+        c.level[f] = ladder.flagLevel(f);
+        if (!c.level[f]) continue;
+
+        // same calls handleHomicide/handleSuicide make
+        // except a penalty of 0, which here means no demotion at all
+        int delta = 0;
+        c.next[f] = ladder.getNextFlag(f, delta, 1);
+        int prev = (suicidePenalty > 0) ? ladder.getPrevFlag(f, delta, suicidePenalty) : f;
+        c.afterSuicide[f] = (prev < 0) ? f : prev;
+        prev = (cheatPenalty > 0) ? ladder.getPrevFlag(f, delta, cheatPenalty) : f;
+        c.afterCheat[f] = (prev < 0) ? c.firstFlag : prev;
+
+        c.killRate[f] = options.killsPerMin[f] / 60.0;
+        c.suicideRate[f] = options.suicidesPerMin[f] / 60.0;
+    }
+}
+
+// event-driven: the next kill/suicide anywhere is exponential in the
+// total rate, and whose it is goes by each player's share of that rate
+static void playMatch(const SimConfig &c, Rng &rng, SimResult &r)
+{
+    int flag[SIM_MAXPLAYERS];
+    double since[SIM_MAXPLAYERS];
+    double rate[SIM_MAXPLAYERS];
+    double totalRate = 0.0;
+    double t = 0.0;
+
+    for (int p = 0; p < c.players; ++p)
+    {
+        flag[p] = c.firstFlag;
+        since[p] = 0.0;
+        rate[p] = c.killRate[flag[p]] + c.suicideRate[flag[p]];
+        totalRate += rate[p];
+        r.visits[flag[p]]++;
+    }
+
+    bool won = false;
+    while (!won)
+    {
+        if (totalRate <= 0.0) break;
+        t += -log(1.0 - rng.uniform()) / totalRate;
+        if (t > options.maxMatchSec) break;
+
+        // whose event?
+        double pick = rng.uniform() * totalRate;
+        int p = 0;
+        while ((p < c.players - 1) && (pick >= rate[p]))
+        {
+            pick -= rate[p];
+            p++;
+        }
+
+        int oldFlag = flag[p];
+        int newFlag = oldFlag;
+        if (pick < c.killRate[oldFlag])
+        {
+            if ((options.cheatChance > 0.0) && (rng.uniform() < options.cheatChance))
+            {
+                newFlag = c.afterCheat[oldFlag];
+            }
+            else if (oldFlag == c.lastFlag)
+            {
+                won = true;
+            }
+            else
+            {
+                newFlag = c.next[oldFlag];
+            }
+        }
+        else
+        {
+            newFlag = c.afterSuicide[oldFlag];
+        }
+
+        if (newFlag != oldFlag)
+        {
+            double held = t - since[p];
+            r.secAtFlag[oldFlag] += held;
+            if (held >= options.stuckSec) r.stuck[oldFlag]++;
+            r.visits[newFlag]++;
+            flag[p] = newFlag;
+            since[p] = t;
+            totalRate -= rate[p];
+            rate[p] = c.killRate[newFlag] + c.suicideRate[newFlag];
+            totalRate += rate[p];
+        }
+    }
+
+    if (!won) t = options.maxMatchSec;
+    for (int p = 0; p < c.players; ++p)
+    {
+        double held = t - since[p];
+        r.secAtFlag[flag[p]] += held;
+        if (held >= options.stuckSec) r.stuck[flag[p]]++;
+    }
+
+    r.matches++;
+    r.totalSec += t;
+    if (!won)
+    {
+        r.unfinished++;
+        return;
+    }
+    int bin = (int)(t / SIM_BINSEC);
+    r.lengthBins[(bin < SIM_MAXBINS) ? bin : SIM_MAXBINS - 1]++;
+}
+
+static void *worker(void *)
+{
+    for (;;)
+    {
+        long j = __sync_fetch_and_add(&nextJob, 1);
+        if (j >= (long)jobs.size()) break;
+        SimJob &job = jobs[j];
+        Rng rng(job.seed);
+        for (long m = 0; m < job.matches; ++m)
+        {
+            playMatch(configs[job.config], rng, job.result);
+        }
+    }
+    return NULL;
+}
+
+static double lengthPercentile(const SimResult &r, double pct)
+{
+    long finished = r.matches - r.unfinished;
+    if (finished <= 0) return 0.0;
+    long want = (long)ceil(finished * pct / 100.0);
+    long seen = 0;
+    for (int b = 0; b < SIM_MAXBINS; ++b)
+    {
+        seen += r.lengthBins[b];
+        if (seen >= want) return (b + 1) * SIM_BINSEC;
+    }
+    return options.maxMatchSec;
+}
+
+static vector<int> parseList(const char *arg)
+{
+    vector<int> v;
+    const char *c = arg;
+    while (*c)
+    {
+        v.push_back(atoi(c));
+        while (*c && (*c != ',')) c++;
+        if (*c) c++;
+    }
+    return v;
+}
+
+// FLAG=kills[/suicides],...
+static bool parseRates(const char *arg)
+{
+    string spec(arg);
+    size_t start = 0;
+    while (start < spec.size())
+    {
+        size_t end = spec.find(',', start);
+        if (end == string::npos) end = spec.size();
+        string item = spec.substr(start, end - start);
+        size_t eq = item.find('=');
+        if (eq == string::npos) return false;
+
+        string name = item.substr(0, eq);
+        int f = 0;
+        while (possibleFlags[f].flagName && (name != possibleFlags[f].flagName)) f++;
+        if (!possibleFlags[f].flagName) return false;
+
+        options.killsPerMin[f] = atof(item.c_str() + eq + 1);
+        size_t slash = item.find('/', eq);
+        if (slash != string::npos) options.suicidesPerMin[f] = atof(item.c_str() + slash + 1);
+        start = end + 1;
+    }
+    return true;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -p min-max       player counts to sweep (2-12)\n"
+            "  -P list          suicide penalties to sweep, e.g. 0,1,2 (%d) - 0 is no demotion\n"
+            "  -C list          cheat penalties to sweep, e.g. 1,3,5 (%d) - only with -c\n"
+            "  -m matches       matches per configuration (100000)\n"
+            "  -s seed          base RNG seed (1)\n"
+            "  -j threads       worker threads (one per CPU)\n"
+            "  -k FLAG=k[/s],.. kills[/suicides] per minute holding FLAG\n"
+            "  -c chance        chance a kill is caught as a drop-shoot cheat (0)\n"
+            "  -t seconds       time at one flag that counts as stuck (120)\n"
+            "  -v               per-flag time share and stuck rates\n",
+            prog, SUICIDEPENALTY, CHEATPENALTY);
+}
+
+static bool parseOptions(int argc, char **argv)
+{
+    for (int f = 0; f < SIM_MAXFLAGS; ++f)
+    {
+        options.killsPerMin[f] = 1.0;
+        options.suicidesPerMin[f] = 0.02;
+    }
+    for (FlagRate *r = defaultRates; r->flagName; ++r)
+    {
+        for (int f = 0; possibleFlags[f].flagName && (f < SIM_MAXFLAGS); ++f)
+        {
+            if (!strcmp(possibleFlags[f].flagName, r->flagName))
+            {
+                options.killsPerMin[f] = r->killsPerMin;
+                options.suicidesPerMin[f] = r->suicidesPerMin;
+            }
+        }
+    }
+
+    int c;
+    while ((c = getopt(argc, argv, "p:P:C:m:s:j:k:c:t:vh")) != -1)
+    {
+        switch (c)
+        {
+            case 'p':
+                options.minPlayers = atoi(optarg);
+                options.maxPlayers = strchr(optarg, '-') ? atoi(strchr(optarg, '-') + 1) : options.minPlayers;
+                break;
+            case 'P': options.suicidePenalties = parseList(optarg); break;
+            case 'C': options.cheatPenalties = parseList(optarg); break;
+            case 'm': options.matches = atol(optarg); break;
+            case 's': options.seed = strtoul(optarg, NULL, 0); break;
+            case 'j': options.threads = atoi(optarg); break;
+            case 'k': if (!parseRates(optarg)) return false; break;
+            case 'c': options.cheatChance = atof(optarg); break;
+            case 't': options.stuckSec = atof(optarg); break;
+            case 'v': options.verbose = true; break;
+            default: return false;
+        }
+    }
+    if (!options.suicidePenalties.size()) options.suicidePenalties.push_back(SUICIDEPENALTY);
+    if (!options.cheatPenalties.size()) options.cheatPenalties.push_back(CHEATPENALTY);
+    // without cheats the cheat penalty never applies - one pass is enough
+    if (options.cheatChance <= 0.0) options.cheatPenalties.resize(1);
+    if (options.threads <= 0) options.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (options.threads <= 0) options.threads = 1;
+    return (options.minPlayers >= 1) && (options.maxPlayers >= options.minPlayers) &&
+           (options.maxPlayers <= SIM_MAXPLAYERS) && (options.matches > 0);
+}
+
+static void printConfig(const SimConfig &c, const SimResult &r)
+{
+    char cp[16] = "-";
+    if (options.cheatChance > 0.0) snprintf(cp, sizeof(cp), "%d", c.cheatPenalty);
+    printf("%7d %3d %3s %6d %9ld %8.1f %8.1f %8.1f %8.1f %8.1f %7.3f%%\n",
+           c.players, c.suicidePenalty, cp, c.numLevels, r.matches,
+           r.totalSec / r.matches / 60.0,
+           lengthPercentile(r, 10) / 60.0, lengthPercentile(r, 50) / 60.0,
+           lengthPercentile(r, 90) / 60.0, lengthPercentile(r, 99) / 60.0,
+           100.0 * r.unfinished / r.matches);
+    if (!options.verbose) return;
+
+    double playerSec = 0.0;
+    for (int f = 0; f < SIM_MAXFLAGS; ++f) playerSec += r.secAtFlag[f];
+    for (int f = 0; f < SIM_MAXFLAGS; ++f)
+    {
+        if (!c.level[f]) continue;
+        printf("        %2d %-3s time %5.1f%%  visits %10ld  stuck %6.2f%%\n",
+               c.level[f], possibleFlags[f].flagName,
+               playerSec ? 100.0 * r.secAtFlag[f] / playerSec : 0.0,
+               r.visits[f], r.visits[f] ? 100.0 * r.stuck[f] / r.visits[f] : 0.0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (!parseOptions(argc, argv))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (int players = options.minPlayers; players <= options.maxPlayers; ++players)
+    {
+        for (size_t sp = 0; sp < options.suicidePenalties.size(); ++sp)
+        {
+            for (size_t cp = 0; cp < options.cheatPenalties.size(); ++cp)
+            {
+                SimConfig c;
+                buildConfig(c, players, options.suicidePenalties[sp], options.cheatPenalties[cp]);
+                if (c.numLevels > 0) configs.push_back(c);
+            }
+        }
+    }
+    for (size_t c = 0; c < configs.size(); ++c)
+    {
+        long chunks = (options.matches + options.chunk - 1) / options.chunk;
+        for (long k = 0; k < chunks; ++k)
+        {
+            SimJob job;
+            job.config = c;
+            job.matches = (k < chunks - 1) ? options.chunk : options.matches - k * options.chunk;
+            job.seed = mixSeed(options.seed, c, k);
+            jobs.push_back(job);
+        }
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    vector<pthread_t> threads(options.threads);
+    for (int t = 0; t < options.threads; ++t) pthread_create(&threads[t], NULL, worker, NULL);
+    for (int t = 0; t < options.threads; ++t) pthread_join(threads[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    // merge in job order - same totals whatever the thread count
+    vector<SimResult> results(configs.size());
+    for (size_t j = 0; j < jobs.size(); ++j)
+    {
+        results[jobs[j].config].merge(jobs[j].result);
+    }
+
+    printf("%7s %3s %3s %6s %9s %8s %8s %8s %8s %8s %8s\n",
+           "players", "sp", "cp", "levels", "matches", "mean-min", "p10", "p50", "p90", "p99", "unfinished");
+    long total = 0;
+    for (size_t c = 0; c < configs.size(); ++c)
+    {
+        printConfig(configs[c], results[c]);
+        total += results[c].matches;
+    }
+    double sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "%ld matches, %u configurations, %d threads, %.2fs (%.0f matches/s)\n",
+            total, (unsigned int)configs.size(), options.threads, sec, total / sec);
+    return 0;
+}
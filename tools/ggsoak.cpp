@@ -0,0 +1,424 @@
+/*
+Copyright (c) 2013, Dan Ryder
+All rights reserved.
+
+This package is free software;  you can redistribute it and/or
+modify it under the terms of the license found in the file
+named COPYING that should have accompanied this file.
+
+THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+ggsoak.cpp
+invariant soak - drives the plugin inside the fake bzfs with a random
+but plausible stream of server events and checks GunGame's invariants
+after every one
+
+besides the everyday joins, kills and drops it goes looking for the
+orderings that caused trouble on real servers: drops arriving late,
+players leaving while a flag give is pending (the map is kept short of
+flags), joins right behind a win, arena count changes mid-game
+
+on the first broken invariant it prints the seed and the events leading
+up to it and exits 1.  build it with -fsanitize=address,undefined too
+*/
+
+// the plugin is one file - reach its state from in here
+#include "../gunGame.cpp"
+#include "fakeServer.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+#define SOAK_HISTORY 32                // events shown when an invariant breaks
+
+struct SoakOptions
+{
+    SoakOptions() : seed(1), events(2000000), maxPlayers(16), maxArenas(3), maxCopies(3), verbose(false) {}
+
+    unsigned long seed;
+    long events;          // driver actions to run
+    int maxPlayers;
+    int maxArenas;        // _ggArenas is changed now and then, up to this
+    int maxCopies;        // map flag copies, changed now and then, 0 up to this
+    bool verbose;
+};
+
+// xorshift64* - same stream on every platform for a given seed
+class Rng
+{
+public:
+    Rng(unsigned long long seed) : state(seed ? seed : 0x9E3779B97F4A7C15ULL) {}
+
+    unsigned long long next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ULL;
+    }
+
+    double uniform()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    bool chance(double p)
+    {
+        return uniform() < p;
+    }
+
+    int below(int n)
+    {
+        return (int)(uniform() * n);
+    }
+
+private:
+    unsigned long long state;
+};
+
+static const char *ladderFlags[] = {
+    "L", "GM", "SW", "CL", "F", "IB", "A", "MG", "ST", "T", "SB", "V", "BU",
+    "WG", "QT", "M", "B", "O", "RT", "LT", "WA", "JM", "NJ", "RC", "SR", NULL
+};
+
+// what the driver did, for the failure report
+static char history[SOAK_HISTORY][80];
+static long numActions = 0;
+
+static void note(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = snprintf(history[numActions % SOAK_HISTORY], sizeof(history[0]), "%10ld %9.3f ", numActions, fakebzfs::now());
+    vsnprintf(history[numActions % SOAK_HISTORY] + n, sizeof(history[0]) - n, fmt, args);
+    va_end(args);
+    numActions++;
+}
+
+static void printChat(int from, int to, const char *message)
+{
+    printf("[%9.3f] %3d -> %3d: %s\n", fakebzfs::now(), from, to, message);
+}
+
+class Soak
+{
+public:
+    Soak(const SoakOptions &o) : opt(o), rng(o.seed), gg(NULL), joins(0) {}
+
+    bool run();
+
+private:
+    const SoakOptions &opt;
+    Rng rng;
+    GunGame *gg;
+    vector<int> ids;       // connected player IDs
+    long joins;
+
+    int anyone()
+    {
+        return ids.empty() ? -1 : ids[rng.below(ids.size())];
+    }
+
+    // a connected player in the given spawn state, -1 if none turned up
+    int pick(bool spawned)
+    {
+        for (int tries = 0; tries < 8; ++tries)
+        {
+            int id = anyone();
+            if ((id >= 0) && (fakebzfs::isSpawned(id) == spawned)) return id;
+        }
+        return -1;
+    }
+
+    // armed player furthest up the ladder - left to chance nobody ever
+    // gets to the end, and wins are what need soaking most
+    int leader()
+    {
+        int best = -1;
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            int id = ids[i];
+            if (!fakebzfs::isSpawned(id) || !*fakebzfs::heldFlag(id)) continue;
+            if ((best < 0) || (fakebzfs::wins(id) > fakebzfs::wins(best))) best = id;
+        }
+        return best;
+    }
+
+    int holderOf(const char *flag)
+    {
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            if (fakebzfs::isSpawned(ids[i]) && !strcmp(fakebzfs::heldFlag(ids[i]), flag)) return ids[i];
+        }
+        return -1;
+    }
+
+    void join()
+    {
+        if ((int)ids.size() >= opt.maxPlayers) return;
+        char callsign[32];
+        // reuse names now and then, like people reconnecting
+        snprintf(callsign, sizeof(callsign), "soak%ld", rng.chance(0.3) ? (long)rng.below(opt.maxPlayers * 2) : joins);
+        joins++;
+        int id = fakebzfs::join(callsign, (bz_eTeamType)rng.below(5));
+        if (id >= 0)
+        {
+            ids.push_back(id);
+            fakebzfs::setAdmin(id, rng.chance(0.1));
+        }
+        note("join %d %s", id, callsign);
+    }
+
+    void part(int id)
+    {
+        if (id < 0) return;
+        fakebzfs::part(id);
+        ids.erase(find(ids.begin(), ids.end(), id));
+        note("part %d", id);
+    }
+
+    void tick()
+    {
+        // mostly server frames, sometimes a stall long enough for
+        // roster reconciles and give retries to pile up
+        double dt = rng.chance(0.05) ? 0.5 + 2.0 * rng.uniform() : 0.05 * rng.uniform();
+        fakebzfs::setTime(fakebzfs::now() + dt);
+        fakebzfs::tick();
+        note("tick +%.3f", dt);
+    }
+
+    void kill(int victim, int killer, const char *how)
+    {
+        if ((victim < 0) || (killer < 0)) return;
+        note("%s %d by %d (%s)", how, victim, killer, fakebzfs::heldFlag(killer));
+        fakebzfs::kill(victim, killer);
+    }
+
+    void step();
+};
+
+void Soak::step()
+{
+    int r = rng.below(100);
+    if (r < 5)
+    {
+        join();
+    }
+    else if (r < 8)
+    {
+        part(anyone());
+    }
+    else if (r < 20)
+    {
+        int id = pick(false);
+        if (id >= 0)
+        {
+            note("spawn %d", id);
+            fakebzfs::spawn(id);
+        }
+    }
+    else if (r < 38)
+    {
+        int killer = rng.chance(0.7) ? leader() : -1;
+        if (killer < 0) killer = pick(true);
+        int victim = pick(true);
+        if ((killer >= 0) && (victim >= 0) && (killer != victim))
+        {
+            note("shoot %d", killer);
+            if (fakebzfs::shoot(killer) || rng.chance(0.1)) kill(victim, killer, "kill");
+            // leave right after scoring - mid-give if the map is short
+            if (rng.chance(0.05)) part(killer);
+        }
+    }
+    else if (r < 42)
+    {
+        // crush with SR (or whatever the leader has) - wins happen here
+        int killer = holderOf("SR");
+        int victim = pick(true);
+        if ((killer >= 0) && (victim >= 0) && (killer != victim))
+        {
+            kill(victim, killer, "crush");
+            // someone joins just as the match resets
+            if (rng.chance(0.5)) join();
+        }
+    }
+    else if (r < 45)
+    {
+        int id = pick(true);
+        if (id >= 0) kill(id, rng.chance(0.2) ? -1 : id, "suicide");
+    }
+    else if (r < 50)
+    {
+        int id = pick(true);
+        if (id >= 0)
+        {
+            note("drop %d (%s)", id, fakebzfs::heldFlag(id));
+            fakebzfs::dropFlag(id);
+        }
+    }
+    else if (r < 53)
+    {
+        int id = anyone();
+        if (id >= 0)
+        {
+            const char *flag = ladderFlags[rng.below(25)];
+            note("stale drop %d %s", id, flag);
+            fakebzfs::staleDrop(id, flag);
+        }
+    }
+    else if (r < 55)
+    {
+        // a flag lying around the map - shot with it, in a waiting arena too
+        int id = pick(true);
+        if (id >= 0)
+        {
+            const char *flag = ladderFlags[rng.below(25)];
+            note("pick up %d %s", id, flag);
+            if (fakebzfs::pickUp(id, flag)) fakebzfs::shoot(id);
+        }
+    }
+    else if (r < 63)
+    {
+        int id = pick(true);
+        if (id >= 0)
+        {
+            note("move %d", id);
+            fakebzfs::move(id, (float)(rng.uniform() * 800.0 - 400.0), (float)(rng.uniform() * 800.0 - 400.0), 0.0f);
+        }
+    }
+    else if (r < 64)
+    {
+        int id = anyone();
+        static const char *commands[] = {"flags", "winners", "leaders", "ggmem", "ggmulti", "gggives", "ggrepl"};
+        if (id >= 0)
+        {
+            const char *command = commands[rng.below(7)];
+            note("/%s %d", command, id);
+            // a page for /winners, a flag for /gggives
+            fakebzfs::slash(id, command, rng.chance(0.5) ? (strcmp(command, "gggives") ? "2" : "SW") : "");
+        }
+    }
+    else if (r < 65 && rng.chance(0.05))
+    {
+        // map maintenance and admin fiddling, rarely
+        if (rng.chance(0.5))
+        {
+            int copies = rng.below(opt.maxCopies + 1);
+            for (const char **f = ladderFlags; *f; ++f) fakebzfs::setFlagCopies(*f, copies);
+            note("flag copies %d", copies);
+        }
+        else
+        {
+            int arenas = 1 + rng.below(opt.maxArenas);
+            bz_setBZDBInt("_ggArenas", arenas);
+            note("_ggArenas %d", arenas);
+        }
+    }
+    else
+    {
+        tick();
+    }
+}
+
+bool Soak::run()
+{
+    for (const char **f = ladderFlags; *f; ++f) fakebzfs::setFlagCopies(*f, opt.maxCopies);
+    fakebzfs::setFlagRespawnDelay(0.1);
+    fakebzfs::setMeasureLatency(false);
+    if (opt.verbose) fakebzfs::setMessageSink(printChat);
+    fakebzfs::loadPlugin("");
+    gg = dynamic_cast<GunGame *>(fakebzfs::loadedPlugin());
+    if (!gg)
+    {
+        fprintf(stderr, "plugin did not load\n");
+        return false;
+    }
+    bz_setBZDBInt("_ggArenas", 1 + rng.below(opt.maxArenas));
+    bz_setBZDBDouble("_ggCommandCooldown", 0.0);
+    bz_setBZDBString("_ggShmName", "");
+    // tiny winners and spill caps, so reconnecting winners go through the
+    // spill and it fills, drops and is rebuilt
+    bz_setBZDBInt("_ggMaxWinners", 4);
+    bz_setBZDBInt("_ggMaxSpill", 8);
+
+    string why;
+    while (numActions < opt.events)
+    {
+        step();
+        if (!gg->checkInvariants(why))
+        {
+            printf("seed %lu: invariant broken after action %ld: %s\n", opt.seed, numActions - 1, why.c_str());
+            printf("last actions:\n");
+            long first = (numActions > SOAK_HISTORY) ? numActions - SOAK_HISTORY : 0;
+            for (long a = first; a < numActions; ++a) printf("  %s\n", history[a % SOAK_HISTORY]);
+            fakebzfs::unloadPlugin();
+            return false;
+        }
+    }
+    fakebzfs::unloadPlugin();
+    return true;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -s seed      RNG seed (1)\n"
+            "  -e actions   driver actions to run (2000000)\n"
+            "  -n players   most players connected at once, 2-255 (16)\n"
+            "  -a arenas    most arenas to switch between (3)\n"
+            "  -c copies    most copies of each flag in the map (3)\n"
+            "  -v           print plugin chat\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    SoakOptions opt;
+    int c;
+    while ((c = getopt(argc, argv, "s:e:n:a:c:vh")) != -1)
+    {
+        switch (c)
+        {
+            case 's': opt.seed = strtoul(optarg, NULL, 0); break;
+            case 'e': opt.events = atol(optarg); break;
+            case 'n': opt.maxPlayers = atoi(optarg); break;
+            case 'a': opt.maxArenas = atoi(optarg); break;
+            case 'c': opt.maxCopies = atoi(optarg); break;
+            case 'v': opt.verbose = true; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if ((opt.maxPlayers < 2) || (opt.maxPlayers > FAKE_MAXPLAYERS) ||
+        (opt.maxArenas < 1) || (opt.maxArenas > MAXARENAS) || (opt.maxCopies < 1))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    Soak soak(opt);
+    bool ok = soak.run();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    unsigned long events = 0;
+    for (int e = 0; e < bz_eLastEvent; ++e) events += fakebzfs::stats().events[e];
+    double sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "%ld actions, %lu plugin events, %.0f simulated s in %.2fs - %.0f events/s, %.1fM events/min\n",
+            numActions, events, fakebzfs::now(), sec, events / sec, events / sec * 60.0 / 1e6);
+    return ok ? 0 : 1;
+}